@@ -1,356 +1,3031 @@
 #define _GNU_SOURCE
+#define MEM_NO_INLINE               /* This file defines mem_malloc() itself */
 #include "allocator.h"
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <pthread.h>
+#include <execinfo.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <errno.h>
+#include <time.h>
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23       /* Linux 5.14+ */
+#endif
 
 /* Configuration constants */
 #define MIN_BLOCK_SIZE 32
 #define ALIGNMENT 16
-#define NUM_SIZE_CLASSES 10
-#define MMAP_THRESHOLD (128 * 1024)  /* Use mmap for allocations > 128KB */
-#define BRK_INCREMENT (64 * 1024)    /* Grow heap by 64KB chunks */
+#define NUM_SIZE_CLASSES MEM_SIZE_CLASSES
+#define MMAP_THRESHOLD (128 * 1024)  /* Use extents for allocations > 128KB */
+#define EXTENT_REGION_SIZE ((size_t)1 << (sizeof(void*) == 8 ? 28 : 24))  /* 256MB regions */
+#define HUGE_THRESHOLD (EXTENT_REGION_SIZE / 8)  /* Map individually above this */
+#define BRK_INCREMENT (64 * 1024)    /* Grow heap by at least 64KB */
+#define MAX_GROWTH_INCREMENT (16 * 1024 * 1024)  /* Default cap on one expansion */
+#define GROWTH_PERCENT 100           /* Default expansion: 100% of heap size */
+#define MAX_NUMA_NODES 64
+#define MAX_NUMA_CPUS 1024
+#define HEAP_RESERVE ((size_t)1 << (sizeof(void*) == 8 ? 36 : 28))  /* Address space per region heap */
+
+/* Block origins (block_header_t.is_mmap) */
+#define BLOCK_HEAP 0                 /* Carved from a heap */
+#define BLOCK_MMAP 1                 /* Mapped individually */
+#define BLOCK_FENCE 2                /* Spans memory between two brk segments */
+#define BLOCK_EXTENT 3               /* Carved from an extent region */
+#define BLOCK_ALIGNED 4              /* Placeholder before an over-aligned pointer;
+                                        size is the distance back to the real header */
+
+/* Heap backends */
+#define HEAP_BRK 0                   /* Grown with sbrk() */
+#define HEAP_REGION 1                /* Grown inside a reserved mmap() range */
+#define HEAP_FIXED 2                 /* Caller-provided buffer, never grown */
+#define HEAP_SHARED 3                /* Fixed heap in a shared mapping */
+
+#define SHARED_HEAP_MAGIC 0x6d656d5f68656170ULL  /* "mem_heap" */
+
+/* Heap-relative link: byte offset from the owning heap_t, 0 for NULL.
+ * Storing offsets instead of pointers keeps a heap valid at any address,
+ * which lets one heap be mapped by several processes. */
+typedef intptr_t heap_off_t;
 
 /* Block header structure */
 typedef struct block_header {
     size_t size;                    /* Size of block (including header) */
-    struct block_header* next;      /* Next block in free list */
-    struct block_header* prev;      /* Previous block in free list */
+    heap_off_t next;                /* Next block in free list */
+    heap_off_t prev;                /* Previous block in free list */
     int is_free;                    /* 1 if free, 0 if allocated */
-    int is_mmap;                    /* 1 if allocated via mmap */
+    int is_mmap;                    /* BLOCK_HEAP, BLOCK_MMAP, ... */
 } block_header_t;
 
-/* Segregated free lists - bins for different size classes */
-static block_header_t* free_lists[NUM_SIZE_CLASSES] = {NULL};
+/* Lifetime counters of one size class */
+typedef struct {
+    size_t num_allocations;
+    size_t num_frees;
+    size_t requested_bytes;         /* Bytes asked for */
+    size_t granted_bytes;           /* Block bytes handed out */
+    size_t freed_bytes;             /* Block bytes returned */
+} class_counters_t;
+
+/* Counters updated by every allocation and free. Totals are summed from
+ * the classes when read, so a call updates only its own class. The
+ * default heaps keep them in per-thread shards; heap instances keep
+ * their own. */
+typedef struct {
+    class_counters_t classes[NUM_SIZE_CLASSES];
+} call_counters_t;
+
+/* Extent region: a large reservation, aligned to its size, that large
+ * allocations are carved from. The header occupies the first page. */
+typedef struct extent_region {
+    struct heap* heap;              /* Owning heap */
+    struct extent_region* next;     /* Next region of the same heap */
+} extent_region_t;
+
+/* Huge block mapping: the block header sits at the end of the first page
+ * (so user memory is page aligned) and the page start records the owner */
+typedef struct huge_prefix {
+    struct heap* heap;              /* Owning heap */
+    int sampled;                    /* In the heap profile */
+} huge_prefix_t;
+
+/* Heap: segregated free lists over one contiguous address range.
+ * Everything that points into heap memory is a heap_off_t. */
+typedef struct heap {
+    heap_off_t free_lists[NUM_SIZE_CLASSES];  /* Bins for different size classes */
+    heap_off_t heap_start;          /* First block */
+    heap_off_t heap_end;            /* End of usable memory */
+    heap_off_t reserve_end;         /* End of reserved range (HEAP_REGION only) */
+    heap_off_t top;                 /* Wilderness chunk ending at heap_end */
+    heap_off_t extents;             /* Free extents, in address order */
+    heap_off_t huge_blocks;         /* Live individually mapped blocks */
+    heap_off_t root;                /* Application root object */
+    extent_region_t* regions;       /* Extent regions owned by this heap */
+    size_t heap_size;               /* Bytes obtained from the backend */
+    mem_stats_t stats;              /* Statistics other than call counters */
+    call_counters_t calls;          /* Call counters, unless sharded */
+    int sharded;                    /* Call counters go to the thread's shard */
+    int backend;                    /* HEAP_BRK, HEAP_REGION, HEAP_FIXED, ... */
+    int node;                       /* NUMA node the memory is bound to, -1 if none */
+} heap_t;
+
+/* Shared heap mapping: this header, then the heap state and its blocks.
+ * The heap stores only offsets, so each process may map it anywhere. */
+typedef struct shared_heap {
+    uint64_t magic;                 /* SHARED_HEAP_MAGIC once initialized */
+    size_t size;                    /* Size of the whole mapping */
+    int persistent;                 /* Backed by a regular file */
+    int dirty;                      /* Open, or not closed cleanly */
+    int openers;                    /* Open mem_heap_open_file() handles */
+    pthread_mutex_t lock;           /* Process-shared, robust */
+    heap_t heap;
+} shared_heap_t;
+
+/* Default heap, grown with brk; serves every thread on single-node systems */
+static heap_t main_heap = { .backend = HEAP_BRK, .node = -1, .sharded = 1 };
+
+/* Per-node heaps, used when the machine has more than one NUMA node */
+static heap_t node_heaps[MAX_NUMA_NODES];
+
+/* NUMA topology (0 until detected) */
+static int numa_nodes = 0;
+static unsigned char cpu_node[MAX_NUMA_CPUS];
+
+/* Countdown while profiling is off: how many bytes may be allocated
+ * before a mem_profile_start() takes effect */
+#define PROFILE_POLL_BYTES (1024 * 1024)
+
+/* Exact-size cache shared with the inline mem_malloc() fast path */
+mem_fast_cache_t mem_fast_cache = { .sample_countdown = PROFILE_POLL_BYTES };
+
+/* Path taken by this thread's latest allocation or free, for the latency
+ * histograms; reset by mem_latency_begin() so that a call returning before
+ * it reaches a path (zero size, overflow) is not recorded */
+#define NO_PATH (-1)
+static __thread int last_path __attribute__((tls_model("initial-exec")));
+#ifndef MEM_DISABLE_STATS
+#define SET_PATH(path) (last_path = (path))
+#else
+#define SET_PATH(path) ((void)0)
+#endif
 
-/* Statistics */
-static mem_stats_t stats = {0};
+/* Statistics counters. Each counter has a single writer (the owning
+ * thread, or whoever holds the heap), so an add is a plain load and
+ * store; the relaxed atomic store only keeps readers on other threads
+ * from seeing a torn value. -DMEM_DISABLE_STATS compiles them out. */
+#ifdef MEM_DISABLE_STATS
+#define STAT_ADD(counter, n) ((void)(n))
+#else
+#define STAT_ADD(counter, n) __atomic_store_n(&(counter), (counter) + (n), __ATOMIC_RELAXED)
+#endif
+#define STAT_READ(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
 
-/* Heap boundaries */
-static void* heap_start = NULL;
-static void* heap_end = NULL;
+/* Call counter shard of one thread, on its own cache lines */
+#define MAX_STAT_SHARDS 128
+
+typedef struct {
+    call_counters_t calls;
+    int in_use;                     /* Owned by a live thread */
+} __attribute__((aligned(64))) stat_shard_t;
+
+/* Shards are never freed: a thread that exits hands its shard, counts
+ * and all, to the next new thread, so the sum stays right. Threads
+ * beyond MAX_STAT_SHARDS share the overflow shard under shard_lock. */
+static stat_shard_t stat_shards[MAX_STAT_SHARDS];
+static stat_shard_t overflow_shard;
+static int num_stat_shards = 0;
+static pthread_mutex_t shard_lock = PTHREAD_MUTEX_INITIALIZER;
+#ifndef MEM_DISABLE_STATS
+static pthread_key_t shard_key;
+static pthread_once_t shard_key_once = PTHREAD_ONCE_INIT;
+static __thread stat_shard_t* thread_shard __attribute__((tls_model("initial-exec")));
+#endif
+
+/* Heap growth policy */
+static mem_growth_policy_t growth_policy = {
+    BRK_INCREMENT, MAX_GROWTH_INCREMENT, GROWTH_PERCENT
+};
+
+/* Helper function: Resolve a heap-relative link */
+static inline void* hptr(const heap_t* h, heap_off_t off) {
+    return off ? (void*)((uintptr_t)h + (uintptr_t)off) : NULL;
+}
+
+/* Helper function: Make a heap-relative link */
+static inline heap_off_t hoff(const heap_t* h, const void* p) {
+    return p ? (heap_off_t)((uintptr_t)p - (uintptr_t)h) : 0;
+}
 
 /* Helper function: Align size to ALIGNMENT boundary */
 static inline size_t align_size(size_t size) {
     return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
 }
 
-/* Helper function: Get size class index for a given size */
-static int get_size_class(size_t size) {
+/* Helper function: Get size class index for a given size: classes are
+ * powers of two from 32 bytes, the last one takes everything larger */
+static inline int get_size_class(size_t size) {
     if (size <= 32) return 0;
-    if (size <= 64) return 1;
-    if (size <= 128) return 2;
-    if (size <= 256) return 3;
-    if (size <= 512) return 4;
-    if (size <= 1024) return 5;
-    if (size <= 2048) return 6;
-    if (size <= 4096) return 7;
-    if (size <= 8192) return 8;
-    return 9;  /* Large allocations */
+    int cls = 64 - __builtin_clzll((unsigned long long)size - 1) - 5;  /* ceil(log2(size)) - 5 */
+    return cls < NUM_SIZE_CLASSES - 1 ? cls : NUM_SIZE_CLASSES - 1;
+}
+
+/* Helper function: System page size */
+static size_t page_size(void) {
+    static size_t cached = 0;
+    if (cached == 0) {
+        long ps = sysconf(_SC_PAGESIZE);
+        cached = ps > 0 ? (size_t)ps : 4096;
+    }
+    return cached;
+}
+
+/* Read a small sysfs file without stdio, which may allocate */
+static int read_sysfs(const char* path, char* buf, size_t len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t n = read(fd, buf, len - 1);
+    close(fd);
+    if (n < 0) {
+        return -1;
+    }
+    buf[n] = '\0';
+    return 0;
+}
+
+/* Parse a sysfs list such as "0-3,8-11"; returns the highest entry or -1.
+ * Every listed index below map_len is set to value in map (if given). */
+static int parse_sysfs_list(const char* s, unsigned char* map, int map_len, int value) {
+    int highest = -1;
+    
+    while (*s >= '0' && *s <= '9') {
+        int lo = 0, hi;
+        while (*s >= '0' && *s <= '9') {
+            lo = lo * 10 + (*s++ - '0');
+        }
+        hi = lo;
+        if (*s == '-') {
+            s++;
+            hi = 0;
+            while (*s >= '0' && *s <= '9') {
+                hi = hi * 10 + (*s++ - '0');
+            }
+        }
+        for (int i = lo; map && i <= hi && i < map_len; i++) {
+            map[i] = (unsigned char)value;
+        }
+        if (hi > highest) {
+            highest = hi;
+        }
+        if (*s == ',') {
+            s++;
+        }
+    }
+    
+    return highest;
+}
+
+/* Detect NUMA nodes and the CPU-to-node map from sysfs */
+static void numa_init(void) {
+    char buf[4096];
+    int nodes = 1;
+    
+    if (read_sysfs("/sys/devices/system/node/online", buf, sizeof(buf)) == 0) {
+        int highest = parse_sysfs_list(buf, NULL, 0, 0);
+        if (highest >= 1) {
+            nodes = highest + 1 < MAX_NUMA_NODES ? highest + 1 : MAX_NUMA_NODES;
+        }
+    }
+    
+    for (int node = 1; node < nodes; node++) {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        if (read_sysfs(path, buf, sizeof(buf)) == 0) {
+            parse_sysfs_list(buf, cpu_node, MAX_NUMA_CPUS, node);
+        }
+    }
+    
+    numa_nodes = nodes;
+}
+
+/* Bind a range to one NUMA node via the raw mbind syscall (no libnuma).
+ * Failure is not fatal: the memory stays usable, only placement is lost.
+ * The kernel reads maxnode - 1 bits of the mask, hence the + 1. */
+static void bind_to_node(void* addr, size_t len, int node) {
+    unsigned long mask[MAX_NUMA_NODES / (8 * sizeof(unsigned long))] = {0};
+    size_t bits = 8 * sizeof(unsigned long);
+    
+    mask[node / bits] = 1UL << (node % bits);
+    syscall(SYS_mbind, addr, len, MPOL_BIND, mask, (unsigned long)MAX_NUMA_NODES + 1, 0);
+}
+
+/* Get the heap for a NUMA node, reserving its address range on first use */
+static heap_t* node_heap(int node) {
+    if (numa_nodes == 0) {
+        numa_init();
+    }
+    if (node < 0 || node >= numa_nodes) {
+        return NULL;
+    }
+    if (numa_nodes == 1) {
+        return &main_heap;
+    }
+    
+    heap_t* h = &node_heaps[node];
+    if (!h->heap_start) {
+        void* base = mmap(NULL, HEAP_RESERVE, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED) {
+            return NULL;
+        }
+        h->stats.num_mappings++;
+        h->heap_start = hoff(h, base);
+        h->heap_end = h->heap_start;
+        h->reserve_end = hoff(h, (char*)base + HEAP_RESERVE);
+        h->backend = HEAP_REGION;
+        h->node = node;
+        h->sharded = 1;
+    }
+    return h;
+}
+
+/* Get the heap local to the calling thread's NUMA node */
+static heap_t* local_heap(void) {
+    if (numa_nodes == 0) {
+        numa_init();
+    }
+    if (numa_nodes == 1) {
+        return &main_heap;
+    }
+    
+    int cpu = sched_getcpu();
+    heap_t* h = node_heap(cpu >= 0 && cpu < MAX_NUMA_CPUS ? cpu_node[cpu] : 0);
+    return h ? h : node_heap(0);
+}
+
+/* Find the default heap that owns a heap block */
+static heap_t* owner_heap(block_header_t* block) {
+    for (int i = 0; numa_nodes > 1 && i < numa_nodes; i++) {
+        heap_t* h = &node_heaps[i];
+        if ((void*)block >= hptr(h, h->heap_start) && (void*)block < hptr(h, h->heap_end)) {
+            return h;
+        }
+    }
+    return &main_heap;
 }
 
 /* Remove block from free list */
-static void remove_from_free_list(block_header_t* block) {
+static void remove_from_free_list(heap_t* h, block_header_t* block) {
     int class_idx = get_size_class(block->size);
+    block_header_t* prev = hptr(h, block->prev);
+    block_header_t* next = hptr(h, block->next);
     
-    if (block->prev) {
-        block->prev->next = block->next;
+    if (prev) {
+        prev->next = block->next;
     } else {
-        free_lists[class_idx] = block->next;
+        h->free_lists[class_idx] = block->next;
     }
     
-    if (block->next) {
-        block->next->prev = block->prev;
+    if (next) {
+        next->prev = block->prev;
     }
     
-    block->next = NULL;
-    block->prev = NULL;
+    block->next = 0;
+    block->prev = 0;
 }
 
 /* Add block to free list */
-static void add_to_free_list(block_header_t* block) {
+static void add_to_free_list(heap_t* h, block_header_t* block) {
     int class_idx = get_size_class(block->size);
+    block_header_t* head = hptr(h, h->free_lists[class_idx]);
     
-    block->next = free_lists[class_idx];
-    block->prev = NULL;
+    block->next = h->free_lists[class_idx];
+    block->prev = 0;
     
-    if (free_lists[class_idx]) {
-        free_lists[class_idx]->prev = block;
+    if (head) {
+        head->prev = hoff(h, block);
     }
     
-    free_lists[class_idx] = block;
+    h->free_lists[class_idx] = hoff(h, block);
     block->is_free = 1;
 }
 
 /* Coalesce adjacent free blocks */
-static block_header_t* coalesce(block_header_t* block) {
+static block_header_t* coalesce(heap_t* h, block_header_t* block) {
     if (!block || block->is_mmap) {
         return block;
     }
     
-    void* block_end = (void*)block + block->size;
+    char* heap_end = hptr(h, h->heap_end);
+    char* block_end = (char*)block + block->size;
     
     /* Check if next block exists within heap bounds */
-    if ((void*)block_end >= heap_end || (void*)block_end < heap_start) {
+    if (block_end >= heap_end || block_end < (char*)hptr(h, h->heap_start)) {
         return block;
     }
     
     block_header_t* next_block = (block_header_t*)block_end;
     
     /* Additional safety check: ensure next block is within valid range */
-    if ((void*)next_block + sizeof(block_header_t) > heap_end) {
+    if (block_end + sizeof(block_header_t) > heap_end) {
+        return block;
+    }
+    
+    /* Merge into the top chunk, which is never on a free list */
+    if (next_block == hptr(h, h->top)) {
+        block->size += next_block->size;
+        h->top = hoff(h, block);
+        STAT_ADD(h->stats.num_coalesces, 1);
         return block;
     }
     
     /* Check if next block is free */
     if (next_block->is_free && !next_block->is_mmap) {
         /* Coalesce with next block */
-        remove_from_free_list(next_block);
+        remove_from_free_list(h, next_block);
         block->size += next_block->size;
-        stats.num_coalesces++;
+        STAT_ADD(h->stats.num_coalesces, 1);
         
         /* Recursively coalesce */
-        return coalesce(block);
+        return coalesce(h, block);
     }
     
     return block;
 }
 
 /* Split block if it's too large */
-static void split_block(block_header_t* block, size_t size) {
+static void split_block(heap_t* h, block_header_t* block, size_t size) {
     size_t total_size = align_size(size + sizeof(block_header_t));
     
     if (block->size >= total_size + sizeof(block_header_t) + MIN_BLOCK_SIZE) {
         /* Create new free block from remainder */
-        block_header_t* new_block = (block_header_t*)((void*)block + total_size);
+        block_header_t* new_block = (block_header_t*)((char*)block + total_size);
         new_block->size = block->size - total_size;
         new_block->is_free = 1;
-        new_block->is_mmap = 0;
-        new_block->next = NULL;
-        new_block->prev = NULL;
+        new_block->is_mmap = BLOCK_HEAP;
+        new_block->next = 0;
+        new_block->prev = 0;
         
         block->size = total_size;
         
-        add_to_free_list(new_block);
-        stats.num_splits++;
+        add_to_free_list(h, new_block);
+        STAT_ADD(h->stats.num_splits, 1);
     }
 }
 
-/* Expand heap using brk */
-static void* expand_heap(size_t size) {
-    size_t alloc_size = size < BRK_INCREMENT ? BRK_INCREMENT : align_size(size);
+/* Grow a HEAP_REGION heap inside its reservation; returns the old end */
+static void* grow_region(heap_t* h, size_t size) {
+    char* old_end = hptr(h, h->heap_end);
     
-    void* old_brk = sbrk(0);
-    if (old_brk == (void*)-1) {
+    if ((size_t)((char*)hptr(h, h->reserve_end) - old_end) < size) {
+        errno = ENOMEM;
         return NULL;
     }
-    
-    void* new_brk = sbrk(alloc_size);
-    if (new_brk == (void*)-1) {
+    if (mprotect(old_end, size, PROT_READ | PROT_WRITE) != 0) {
         return NULL;
     }
-    
-    if (heap_start == NULL) {
-        heap_start = old_brk;
+    if (h->node >= 0) {
+        bind_to_node(old_end, size, h->node);
     }
-    heap_end = sbrk(0);
-    
-    /* Create new free block */
-    block_header_t* block = (block_header_t*)old_brk;
-    block->size = alloc_size;
-    block->is_free = 1;
-    block->is_mmap = 0;
-    block->next = NULL;
-    block->prev = NULL;
     
-    return block;
+    h->heap_end = hoff(h, old_end + size);
+    return old_end;
 }
 
-/* Find suitable free block */
-static block_header_t* find_free_block(size_t size) {
-    int start_class = get_size_class(size);
+/* Expansion size for a request under the growth policy: a fraction of
+ * the current heap size, bounded, but never less than the request */
+static size_t growth_size(heap_t* h, size_t request) {
+    size_t size = h->heap_size / 100 * growth_policy.growth_percent;
     
-    /* Search in appropriate size class and larger ones */
-    for (int i = start_class; i < NUM_SIZE_CLASSES; i++) {
-        block_header_t* current = free_lists[i];
-        
-        while (current) {
-            if (current->is_free && current->size >= size) {
-                return current;
-            }
-            current = current->next;
-        }
+    if (size > growth_policy.max_increment) {
+        size = growth_policy.max_increment;
     }
-    
-    return NULL;
+    if (size < growth_policy.min_increment) {
+        size = growth_policy.min_increment;
+    }
+    return size < request ? request : size;
 }
 
-/* Thread-unsafe malloc implementation */
-void* mem_malloc(size_t size) {
-    if (size == 0) {
-        return NULL;
+/* Monotonic clock in nanoseconds (0 without statistics) */
+static uint64_t now_ns(void) {
+#ifdef MEM_DISABLE_STATS
+    return 0;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/* Seal a brk segment whose end is no longer the break: the old top
+ * becomes an ordinary free block, followed by an in-use fence spanning
+ * the foreign memory up to next_segment so nothing coalesces across it */
+static void seal_segment(heap_t* h, char* next_segment) {
+    block_header_t* top = hptr(h, h->top);
+    block_header_t* fence = top;
+    
+    if (top->size >= sizeof(block_header_t) + MIN_BLOCK_SIZE) {
+        top->size -= sizeof(block_header_t);
+        fence = (block_header_t*)((char*)top + top->size);
+        add_to_free_list(h, top);
     }
     
-    size_t total_size = align_size(size + sizeof(block_header_t));
-    block_header_t* block;
+    fence->size = (size_t)(next_segment - (char*)fence);
+    fence->is_free = 0;
+    fence->is_mmap = BLOCK_FENCE;
+    fence->next = 0;
+    fence->prev = 0;
+    h->top = 0;
+}
+
+/* Expand heap by size bytes using brk (or the heap's reserved region).
+ * Contiguous memory extends the top chunk in place; otherwise the old
+ * segment is sealed and the new memory becomes the top chunk.
+ * Returns the start of the new memory. */
+static void* expand_heap(heap_t* h, size_t size) {
+    size_t alloc_size = align_size(size);
+    uint64_t start_ns = now_ns();
+    char* start;
     
-    /* Use mmap for large allocations */
-    if (total_size >= MMAP_THRESHOLD) {
-        void* ptr = mmap(NULL, total_size, PROT_READ | PROT_WRITE,
-                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-        if (ptr == MAP_FAILED) {
+    if (h->backend >= HEAP_FIXED) {
+        errno = ENOMEM;
+        return NULL;
+    } else if (h->backend == HEAP_REGION) {
+        alloc_size = (alloc_size + page_size() - 1) & ~(page_size() - 1);
+        start = grow_region(h, alloc_size);
+        if (start == NULL) {
+            return NULL;
+        }
+    } else {
+        /* Use sbrk's return value, not sbrk(0): another allocator may move
+         * the break between the two calls */
+        char* old_brk = sbrk(alloc_size);
+        if (old_brk == (void*)-1) {
             return NULL;
         }
         
-        block = (block_header_t*)ptr;
-        block->size = total_size;
-        block->is_free = 0;
-        block->is_mmap = 1;
-        block->next = NULL;
-        block->prev = NULL;
-        
-        stats.total_allocated += total_size;
-        stats.current_usage += total_size;
-        stats.num_allocations++;
-        
-        return (void*)((char*)block + sizeof(block_header_t));
+        start = (char*)align_size((uintptr_t)old_brk);
+        if (!h->heap_start) {
+            h->heap_start = hoff(h, start);
+        } else if (start != hptr(h, h->heap_end)) {
+            seal_segment(h, start);  /* Someone else moved the break */
+        }
+        h->heap_end = hoff(h, old_brk + alloc_size);
     }
     
-    /* Try to find free block */
-    block = find_free_block(total_size);
+    h->heap_size += alloc_size;
+    STAT_ADD(h->stats.num_expansions, 1);
     
-    if (!block) {
-        /* No suitable free block, expand heap */
-        block = expand_heap(total_size);
-        if (!block) {
+    block_header_t* top = hptr(h, h->top);
+    if (top) {
+        top->size += alloc_size;
+    } else {
+        top = (block_header_t*)start;
+        top->size = (size_t)((char*)hptr(h, h->heap_end) - start);
+        top->is_free = 1;
+        top->is_mmap = BLOCK_HEAP;
+        top->next = 0;
+        top->prev = 0;
+        h->top = hoff(h, top);
+    }
+    
+    STAT_ADD(h->stats.growth_ns, now_ns() - start_ns);
+    return start;
+}
+
+/* Carve an allocated block of total_size bytes off the front of the top
+ * chunk, growing the heap first if the top chunk is too small. The top
+ * always keeps at least MIN_BLOCK_SIZE bytes so it never disappears. */
+static block_header_t* carve_top(heap_t* h, size_t total_size) {
+    block_header_t* block = hptr(h, h->top);
+    
+    if (!block || block->size < total_size + MIN_BLOCK_SIZE) {
+        SET_PATH(MEM_PATH_GROWTH);
+        if (!expand_heap(h, growth_size(h, total_size + MIN_BLOCK_SIZE + ALIGNMENT))) {
+            return NULL;
+        }
+        block = hptr(h, h->top);
+        if (block->size < total_size + MIN_BLOCK_SIZE) {
             return NULL;
         }
     }
     
-    /* Remove from free list */
-    remove_from_free_list(block);
+    block_header_t* rest = (block_header_t*)((char*)block + total_size);
+    rest->size = block->size - total_size;
+    rest->is_free = 1;
+    rest->is_mmap = BLOCK_HEAP;
+    rest->next = 0;
+    rest->prev = 0;
     
-    /* Split if block is too large */
-    split_block(block, size);
+    block->size = total_size;
+    h->top = hoff(h, rest);
+    return block;
+}
+
+/* Return the top chunk beyond pad bytes to the system; returns bytes released */
+static size_t trim_heap(heap_t* h, size_t pad) {
+    block_header_t* top = hptr(h, h->top);
+    if (!top || h->backend >= HEAP_FIXED) {
+        return 0;
+    }
     
-    block->is_free = 0;
+    size_t keep = MIN_BLOCK_SIZE + align_size(pad);
+    if (top->size <= keep + page_size()) {
+        return 0;
+    }
+    size_t release = (top->size - keep) & ~(page_size() - 1);
+    char* heap_end = hptr(h, h->heap_end);
+    char* new_end = heap_end - release;
     
-    stats.total_allocated += block->size;
-    stats.current_usage += block->size;
-    stats.num_allocations++;
+    if (h->backend == HEAP_REGION) {
+        madvise(new_end, release, MADV_DONTNEED);
+        if (mprotect(new_end, release, PROT_NONE) != 0) {
+            return 0;
+        }
+    } else {
+        /* Only possible while our top chunk ends at the break */
+        if (sbrk(0) != heap_end || sbrk(-(intptr_t)release) == (void*)-1) {
+            return 0;
+        }
+    }
     
-    return (void*)((char*)block + sizeof(block_header_t));
+    h->heap_end = hoff(h, new_end);
+    h->heap_size -= release;
+    top->size -= release;
+    return release;
 }
 
-/* Thread-unsafe free implementation */
-void mem_free(void* ptr) {
-    if (!ptr) {
-        return;
+/* Rebuild a heap's free lists from the block flags, merging free runs */
+static void rebuild_free_lists(heap_t* h) {
+    for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+        h->free_lists[i] = 0;
     }
     
-    block_header_t* block = (block_header_t*)((char*)ptr - sizeof(block_header_t));
+    block_header_t* top = hptr(h, h->top);
+    char* end = hptr(h, h->heap_end);
+    char* p = hptr(h, h->heap_start);
+    while (p && p < end) {
+        block_header_t* block = (block_header_t*)p;
+        if (block == top) {
+            break;
+        }
+        
+        if (block->is_free) {
+            block_header_t* next = (block_header_t*)(p + block->size);
+            while (next != top && next->is_free) {
+                block->size += next->size;
+                next = (block_header_t*)((char*)next + next->size);
+            }
+            if (next == top) {
+                block->size += next->size;
+                h->top = hoff(h, block);
+                break;
+            }
+            add_to_free_list(h, block);
+        }
+        p += block->size;
+    }
+}
+
+/* Insert a free extent in address order, merging it with its neighbours.
+ * Regions start with a header page, so extents of different regions are
+ * never adjacent. Returns the resulting free extent. */
+static block_header_t* extent_insert(heap_t* h, block_header_t* block) {
+    block_header_t* prev = NULL;
+    block_header_t* next = hptr(h, h->extents);
     
-    if (block->is_mmap) {
-        /* Unmap large allocation */
-        stats.total_freed += block->size;
-        stats.current_usage -= block->size;
-        stats.num_frees++;
-        munmap(block, block->size);
-        return;
+    while (next && next < block) {
+        prev = next;
+        next = hptr(h, next->next);
     }
+    block->is_free = 1;
     
-    stats.total_freed += block->size;
-    stats.current_usage -= block->size;
-    stats.num_frees++;
+    /* Absorb the following extent */
+    if (next && (char*)block + block->size == (char*)next) {
+        block->size += next->size;
+        next = hptr(h, next->next);
+        STAT_ADD(h->stats.num_coalesces, 1);
+    }
     
-    /* Coalesce with adjacent free blocks */
-    block->is_free = 1;
-    block = coalesce(block);
+    /* Merge into the preceding extent */
+    if (prev && (char*)prev + prev->size == (char*)block) {
+        prev->size += block->size;
+        prev->next = hoff(h, next);
+        if (next) {
+            next->prev = hoff(h, prev);
+        }
+        STAT_ADD(h->stats.num_coalesces, 1);
+        return prev;
+    }
     
-    /* Add to appropriate free list */
-    add_to_free_list(block);
+    block->prev = hoff(h, prev);
+    block->next = hoff(h, next);
+    if (prev) {
+        prev->next = hoff(h, block);
+    } else {
+        h->extents = hoff(h, block);
+    }
+    if (next) {
+        next->prev = hoff(h, block);
+    }
+    return block;
 }
 
-/* Thread-unsafe calloc implementation */
-void* mem_calloc(size_t nmemb, size_t size) {
-    if (nmemb == 0 || size == 0) {
+/* Reserve a new extent region for a heap; returns its free extent */
+static block_header_t* extent_region_create(heap_t* h) {
+    size_t region_size = EXTENT_REGION_SIZE;
+    
+    /* Over-map to align the region to its size, then trim the excess */
+    char* raw = mmap(NULL, 2 * region_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (raw == MAP_FAILED) {
         return NULL;
     }
+    char* base = (char*)(((uintptr_t)raw + region_size - 1) & ~(uintptr_t)(region_size - 1));
+    if (base > raw) {
+        munmap(raw, (size_t)(base - raw));
+    }
+    munmap(base + region_size, (size_t)(raw + region_size - base));
+    if (h->node >= 0) {
+        bind_to_node(base, region_size, h->node);
+    }
+    h->stats.num_mappings++;
     
-    /* Check for overflow */
-    size_t total = nmemb * size;
-    if (total / nmemb != size) {
-        return NULL;  /* Overflow */
+    extent_region_t* region = (extent_region_t*)base;
+    region->heap = h;
+    region->next = h->regions;
+    h->regions = region;
+    
+    block_header_t* block = (block_header_t*)(base + page_size());
+    block->size = region_size - page_size();
+    block->is_mmap = BLOCK_EXTENT;
+    return extent_insert(h, block);
+}
+
+/* Allocate a large block from the heap's extents (address-ordered best fit) */
+static block_header_t* extent_alloc(heap_t* h, size_t total_size) {
+    size_t need = (total_size + page_size() - 1) & ~(page_size() - 1);
+    block_header_t* best = NULL;
+    
+    for (block_header_t* e = hptr(h, h->extents); e; e = hptr(h, e->next)) {
+        if (e->size >= need && (!best || e->size < best->size)) {
+            best = e;
+            if (e->size == need) {
+                break;
+            }
+        }
+    }
+    if (!best) {
+        best = extent_region_create(h);
+        if (!best) {
+            return NULL;
+        }
     }
     
-    void* ptr = mem_malloc(total);
-    if (ptr) {
-        memset(ptr, 0, total);
+    block_header_t* prev = hptr(h, best->prev);
+    block_header_t* next = hptr(h, best->next);
+    
+    if (best->size - need >= page_size()) {
+        /* Keep the tail free in the same list position */
+        block_header_t* rest = (block_header_t*)((char*)best + need);
+        rest->size = best->size - need;
+        rest->is_free = 1;
+        rest->is_mmap = BLOCK_EXTENT;
+        rest->prev = best->prev;
+        rest->next = best->next;
+        if (prev) {
+            prev->next = hoff(h, rest);
+        } else {
+            h->extents = hoff(h, rest);
+        }
+        if (next) {
+            next->prev = hoff(h, rest);
+        }
+        best->size = need;
+        STAT_ADD(h->stats.num_splits, 1);
+    } else {
+        if (prev) {
+            prev->next = best->next;
+        } else {
+            h->extents = best->next;
+        }
+        if (next) {
+            next->prev = best->prev;
+        }
     }
     
-    return ptr;
+    best->is_free = 0;
+    best->next = 0;
+    best->prev = 0;
+    return best;
 }
 
-/* Thread-unsafe realloc implementation */
-void* mem_realloc(void* ptr, size_t size) {
-    if (!ptr) {
-        return mem_malloc(size);
+/* Return a large block to its region's free extents */
+static void extent_free(block_header_t* block) {
+    extent_region_t* region = (extent_region_t*)((uintptr_t)block & ~(uintptr_t)(EXTENT_REGION_SIZE - 1));
+    
+    /* Give the block's whole pages back to the kernel (the extent stays mapped) */
+    uintptr_t start = ((uintptr_t)block + sizeof(block_header_t) + page_size() - 1) & ~(uintptr_t)(page_size() - 1);
+    uintptr_t end = (uintptr_t)block + block->size;
+    if (end > start) {
+        madvise((void*)start, end - start, MADV_FREE);
     }
     
-    if (size == 0) {
-        mem_free(ptr);
+    extent_insert(region->heap, block);
+}
+
+/* Map a huge block on its own and link it into the heap's huge list */
+static block_header_t* huge_alloc(heap_t* h, size_t total_size) {
+    size_t len = (page_size() - sizeof(block_header_t) + total_size + page_size() - 1) & ~(page_size() - 1);
+    char* base = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
         return NULL;
     }
+    if (h->node >= 0) {
+        bind_to_node(base, len, h->node);
+    }
+    ((huge_prefix_t*)base)->heap = h;
+    ((huge_prefix_t*)base)->sampled = 0;
     
-    block_header_t* block = (block_header_t*)((char*)ptr - sizeof(block_header_t));
-    size_t old_size = block->size - sizeof(block_header_t);
-    
-    if (old_size >= size) {
-        /* Current block is large enough */
-        return ptr;
+    block_header_t* block = (block_header_t*)(base + page_size() - sizeof(block_header_t));
+    block->size = (size_t)(base + len - (char*)block);
+    block->is_free = 0;
+    block->is_mmap = BLOCK_MMAP;
+    block->prev = 0;
+    block->next = h->huge_blocks;
+    if (h->huge_blocks) {
+        ((block_header_t*)hptr(h, h->huge_blocks))->prev = hoff(h, block);
     }
+    h->huge_blocks = hoff(h, block);
+    h->stats.num_mappings++;
     
-    /* Allocate new block and copy data */
-    void* new_ptr = mem_malloc(size);
-    if (!new_ptr) {
-        return NULL;
+    return block;
+}
+
+/* Unlink and unmap a huge block */
+static void huge_free(heap_t* h, block_header_t* block) {
+    char* base = (char*)((uintptr_t)block & ~(uintptr_t)(page_size() - 1));
+    block_header_t* prev = hptr(h, block->prev);
+    block_header_t* next = hptr(h, block->next);
+    
+    if (prev) {
+        prev->next = block->next;
+    } else {
+        h->huge_blocks = block->next;
     }
+    if (next) {
+        next->prev = block->prev;
+    }
+    h->stats.num_mappings--;
     
-    memcpy(new_ptr, ptr, old_size);
-    mem_free(ptr);
+    munmap(base, (size_t)((char*)block + block->size - base));
+}
+
+/* Find the heap that owns any block */
+static heap_t* block_heap(block_header_t* block) {
+    uintptr_t addr = (uintptr_t)block;
     
-    return new_ptr;
+    if (block->is_mmap == BLOCK_MMAP) {
+        return ((huge_prefix_t*)(addr & ~(uintptr_t)(page_size() - 1)))->heap;
+    }
+    if (block->is_mmap == BLOCK_EXTENT) {
+        return ((extent_region_t*)(addr & ~(uintptr_t)(EXTENT_REGION_SIZE - 1)))->heap;
+    }
+    return owner_heap(block);
 }
 
-/* Get statistics */
-mem_stats_t mem_get_stats(void) {
-    return stats;
+/* Header of the block holding a user pointer, looking through the
+ * placeholder header of an over-aligned allocation */
+static block_header_t* ptr_block(void* ptr) {
+    block_header_t* block = (block_header_t*)((char*)ptr - sizeof(block_header_t));
+    if (block->is_mmap == BLOCK_ALIGNED) {
+        block = (block_header_t*)((char*)block - block->size);
+    }
+    return block;
 }
 
-/* Print statistics */
-void mem_print_stats(void) {
-    printf("Memory Allocator Statistics:\n");
-    printf("  Total allocated: %zu bytes\n", stats.total_allocated);
-    printf("  Total freed: %zu bytes\n", stats.total_freed);
-    printf("  Current usage: %zu bytes\n", stats.current_usage);
-    printf("  Number of allocations: %zu\n", stats.num_allocations);
-    printf("  Number of frees: %zu\n", stats.num_frees);
-    printf("  Number of splits: %zu\n", stats.num_splits);
-    printf("  Number of coalesces: %zu\n", stats.num_coalesces);
+/* Bytes usable at ptr, up to the end of its block */
+static size_t usable_size(void* ptr) {
+    block_header_t* block = ptr_block(ptr);
+    return (size_t)((char*)block + block->size - (char*)ptr);
 }
 
-/* Reset allocator state (for testing) */
-void mem_reset(void) {
-    /* Reset statistics */
-    memset(&stats, 0, sizeof(stats));
+#ifndef MEM_DISABLE_STATS
+/* Release a thread's shard at exit */
+static void shard_release(void* shard) {
+    __atomic_store_n(&((stat_shard_t*)shard)->in_use, 0, __ATOMIC_RELEASE);
+    thread_shard = NULL;
+}
+
+static void shard_key_create(void) {
+    pthread_key_create(&shard_key, shard_release);
+}
+
+/* Give the calling thread a shard (a free one, or the overflow shard) */
+static stat_shard_t* shard_acquire(void) {
+    pthread_once(&shard_key_once, shard_key_create);
     
-    /* Clear free lists */
-    for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
-        free_lists[i] = NULL;
+    stat_shard_t* shard = &overflow_shard;
+    pthread_mutex_lock(&shard_lock);
+    for (int i = 0; i < num_stat_shards; i++) {
+        if (!__atomic_load_n(&stat_shards[i].in_use, __ATOMIC_ACQUIRE)) {
+            shard = &stat_shards[i];
+            break;
+        }
+    }
+    if (shard == &overflow_shard && num_stat_shards < MAX_STAT_SHARDS) {
+        shard = &stat_shards[num_stat_shards];
+        __atomic_store_n(&num_stat_shards, num_stat_shards + 1, __ATOMIC_RELEASE);
+    }
+    if (shard != &overflow_shard) {
+        __atomic_store_n(&shard->in_use, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&shard_lock);
+    
+    thread_shard = shard;
+    pthread_setspecific(shard_key, shard != &overflow_shard ? shard : NULL);
+    return shard;
+}
+
+/* Call counters of the calling thread; NULL if it shares the overflow
+ * shard, which must be updated under shard_lock */
+static inline call_counters_t* thread_calls(void) {
+    stat_shard_t* shard = thread_shard;
+    if (__builtin_expect(shard == NULL, 0)) {
+        shard = shard_acquire();
+    }
+    return shard != &overflow_shard ? &shard->calls : NULL;
+}
+
+static inline __attribute__((always_inline)) void add_alloc(call_counters_t* c, size_t requested, size_t size) {
+    class_counters_t* cc = &c->classes[get_size_class(size)];
+    STAT_ADD(cc->num_allocations, 1);
+    STAT_ADD(cc->requested_bytes, requested);
+    STAT_ADD(cc->granted_bytes, size);
+}
+
+static inline __attribute__((always_inline)) void add_free(call_counters_t* c, size_t size) {
+    class_counters_t* cc = &c->classes[get_size_class(size)];
+    STAT_ADD(cc->num_frees, 1);
+    STAT_ADD(cc->freed_bytes, size);
+}
+
+/* Count an allocation of a size-byte block for a requested-byte call */
+static inline void count_alloc(heap_t* h, size_t requested, size_t size) {
+    call_counters_t* c = h->sharded ? thread_calls() : &h->calls;
+    if (__builtin_expect(c != NULL, 1)) {
+        add_alloc(c, requested, size);
+        return;
+    }
+    pthread_mutex_lock(&shard_lock);
+    add_alloc(&overflow_shard.calls, requested, size);
+    pthread_mutex_unlock(&shard_lock);
+}
+
+/* Count the free of a size-byte block */
+static inline void count_free(heap_t* h, size_t size) {
+    call_counters_t* c = h->sharded ? thread_calls() : &h->calls;
+    if (__builtin_expect(c != NULL, 1)) {
+        add_free(c, size);
+        return;
+    }
+    pthread_mutex_lock(&shard_lock);
+    add_free(&overflow_shard.calls, size);
+    pthread_mutex_unlock(&shard_lock);
+}
+#else
+#define count_alloc(h, requested, size) ((void)(h), (void)(requested), (void)(size))
+#define count_free(h, size) ((void)(h), (void)(size))
+#endif
+
+/* Sampled heap profile. The default heaps' allocation calls count the
+ * bytes they hand out down from mem_fast_cache.sample_countdown; the call
+ * that crosses zero is sampled and the countdown is redrawn from an
+ * exponential distribution with mean profile_rate. Every byte is then
+ * equally likely to be sampled, which is what pprof's heap_v2 scaling
+ * assumes. A sampled block is tagged (prev == PROFILE_MARK, which no
+ * heap offset can equal, or in the prefix page of a huge block) so that
+ * freeing any other block costs one compare. Records live in mmap'd
+ * hash tables under profile_lock, never in the heaps being profiled. */
+#define PROFILE_DEFAULT_RATE (512 * 1024)
+#define PROFILE_DEPTH 32                 /* Frames kept per stack */
+#define PROFILE_SKIP 2                   /* profile_sample and the allocation call */
+#define PROFILE_MAX_SKIP 8               /* ... plus wrappers (_ts, shim, operator new) */
+#define PROFILE_STACKS 4096              /* Distinct stacks (power of two) */
+#define PROFILE_SAMPLES 65536            /* Live samples (power of two) */
+#define PROFILE_MARK 1                   /* block_header_t.prev of a sampled block */
+
+/* Samples taken at one call stack */
+typedef struct {
+    uint64_t hash;                  /* 0 for an empty slot */
+    int depth;
+    void* pcs[PROFILE_DEPTH];
+    size_t live_count;
+    size_t live_bytes;
+    size_t alloc_count;
+    size_t alloc_bytes;
+} profile_stack_t;
+
+/* A live sampled allocation */
+typedef struct {
+    void* ptr;                      /* NULL for an empty slot */
+    size_t size;                    /* Bytes requested */
+    size_t stack;                   /* Index in profile_stacks */
+} profile_sample_t;
+
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t profile_rate;         /* Mean bytes between samples, 0 when off */
+static int profile_counting;        /* The countdown is a sampling interval, not a poll */
+static uint64_t profile_rng = 0x9e3779b97f4a7c15ULL;
+static profile_stack_t* profile_stacks;
+static profile_sample_t* profile_samples;
+static size_t profile_num_stacks;
+static size_t profile_num_samples;
+static char profile_exit_path[PATH_MAX];
+
+/* Natural logarithm of x > 0 without libm: split off the binary exponent,
+ * then ln(m) = 2 artanh((m - 1) / (m + 1)) for m in [1, 2) */
+static double profile_log(double x) {
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    int exponent = (int)((bits >> 52) & 0x7ff) - 1023;
+    bits = (bits & ((1ULL << 52) - 1)) | (1023ULL << 52);
+    double m;
+    memcpy(&m, &bits, sizeof(m));
+    
+    double t = (m - 1) / (m + 1);
+    double t2 = t * t;
+    double ln_m = 2 * t * (1 + t2 * (1.0 / 3 + t2 * (1.0 / 5 + t2 * (1.0 / 7 + t2 / 9))));
+    return exponent * 0.6931471805599453 + ln_m;
+}
+
+/* Bytes until the next sample: exponential with mean rate */
+static size_t profile_interval(size_t rate) {
+    profile_rng ^= profile_rng << 13;
+    profile_rng ^= profile_rng >> 7;
+    profile_rng ^= profile_rng << 17;
+    double u = (double)((profile_rng >> 11) + 1) * 0x1.0p-53;  /* (0, 1] */
+    return (size_t)(-profile_log(u) * (double)rate) + 1;
+}
+
+static size_t profile_slot(void* ptr) {
+    return (size_t)(((uint64_t)(uintptr_t)ptr * 0x9e3779b97f4a7c15ULL) >> 32) & (PROFILE_SAMPLES - 1);
+}
+
+static int profile_marked(block_header_t* block) {
+    if (block->is_mmap == BLOCK_MMAP) {
+        return ((huge_prefix_t*)((uintptr_t)block & ~(uintptr_t)(page_size() - 1)))->sampled;
+    }
+    return block->prev == PROFILE_MARK;
+}
+
+static void profile_set_mark(block_header_t* block, int sampled) {
+    if (block->is_mmap == BLOCK_MMAP) {
+        ((huge_prefix_t*)((uintptr_t)block & ~(uintptr_t)(page_size() - 1)))->sampled = sampled;
+    } else {
+        block->prev = sampled ? PROFILE_MARK : 0;
+    }
+}
+
+/* Stack table slot for a call stack, or NULL when the table is full */
+static profile_stack_t* profile_find_stack(void** pcs, int depth) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (int i = 0; i < depth; i++) {
+        hash = (hash ^ (uint64_t)(uintptr_t)pcs[i]) * 1099511628211ULL;
+    }
+    hash |= 1;
+    
+    size_t mask = PROFILE_STACKS - 1;
+    for (size_t i = (size_t)hash & mask;; i = (i + 1) & mask) {
+        profile_stack_t* s = &profile_stacks[i];
+        if (s->hash == hash && s->depth == depth && memcmp(s->pcs, pcs, depth * sizeof(void*)) == 0) {
+            return s;
+        }
+        if (s->hash == 0) {
+            if (profile_num_stacks >= PROFILE_STACKS / 4 * 3) {
+                return NULL;
+            }
+            s->hash = hash;
+            s->depth = depth;
+            memcpy(s->pcs, pcs, depth * sizeof(void*));
+            profile_num_stacks++;
+            return s;
+        }
+    }
+}
+
+/* Bounds of the MEM_ENTRY section, provided by the linker (weak, so they
+ * are NULL where the section does not exist) */
+extern char __start_mem_entry[] __attribute__((weak, visibility("hidden")));
+extern char __stop_mem_entry[] __attribute__((weak, visibility("hidden")));
+
+/* Whether a return address lies in one of the allocation entry points */
+static int profile_in_entry(void* pc) {
+    return (char*)pc > __start_mem_entry && (char*)pc <= __stop_mem_entry;
+}
+
+/* An allocation call crossed the countdown: sample it, and restart the
+ * countdown. Also runs every PROFILE_POLL_BYTES while profiling is off. */
+static __attribute__((noinline, cold)) void profile_sample(void* ptr, size_t size) {
+    size_t rate = __atomic_load_n(&profile_rate, __ATOMIC_ACQUIRE);
+    if (rate == 0) {
+        mem_fast_cache.sample_countdown = PROFILE_POLL_BYTES;
+        profile_counting = 0;
+        return;
+    }
+    
+    /* The first crossing after a start only begins the countdown */
+    int take = profile_counting;
+    mem_fast_cache.sample_countdown = profile_interval(rate);
+    profile_counting = 1;
+    if (!ptr || !take) {
+        return;
+    }
+    
+    void* pcs[PROFILE_DEPTH + PROFILE_MAX_SKIP];
+    int depth = backtrace(pcs, PROFILE_DEPTH + PROFILE_MAX_SKIP);
+    int skip = PROFILE_SKIP;
+    while (skip < depth && skip < PROFILE_MAX_SKIP && profile_in_entry(pcs[skip])) {
+        skip++;
+    }
+    depth -= skip;
+    if (depth < 0) {
+        depth = 0;
+    } else if (depth > PROFILE_DEPTH) {
+        depth = PROFILE_DEPTH;
+    }
+    
+    pthread_mutex_lock(&profile_lock);
+    profile_stack_t* stack = profile_find_stack(pcs + skip, depth);
+    if (stack && profile_num_samples < PROFILE_SAMPLES / 4 * 3) {
+        size_t i = profile_slot(ptr);
+        while (profile_samples[i].ptr) {
+            i = (i + 1) & (PROFILE_SAMPLES - 1);
+        }
+        profile_samples[i].ptr = ptr;
+        profile_samples[i].size = size;
+        profile_samples[i].stack = (size_t)(stack - profile_stacks);
+        profile_num_samples++;
+        
+        stack->live_count++;
+        stack->live_bytes += size;
+        stack->alloc_count++;
+        stack->alloc_bytes += size;
+        profile_set_mark(ptr_block(ptr), 1);
+    }
+    pthread_mutex_unlock(&profile_lock);
+}
+
+/* Count an allocation call of the default heaps toward the next sample */
+static inline __attribute__((always_inline)) void* profile_count(void* ptr, size_t size) {
+    if (__builtin_expect(size >= mem_fast_cache.sample_countdown, 0)) {
+        profile_sample(ptr, size);
+    } else {
+        mem_fast_cache.sample_countdown -= size;
+    }
+    return ptr;
+}
+
+/* A sampled block is being freed: drop its record */
+static __attribute__((noinline, cold)) void profile_forget(block_header_t* block, void* ptr) {
+    size_t mask = PROFILE_SAMPLES - 1;
+    
+    pthread_mutex_lock(&profile_lock);
+    size_t i = profile_slot(ptr);
+    while (profile_samples[i].ptr && profile_samples[i].ptr != ptr) {
+        i = (i + 1) & mask;
+    }
+    if (profile_samples[i].ptr) {
+        profile_stack_t* stack = &profile_stacks[profile_samples[i].stack];
+        stack->live_count--;
+        stack->live_bytes -= profile_samples[i].size;
+        profile_num_samples--;
+        
+        /* Close the gap: move back later entries of the probe run
+         * that may live at or before i */
+        for (size_t j = (i + 1) & mask; profile_samples[j].ptr; j = (j + 1) & mask) {
+            size_t home = profile_slot(profile_samples[j].ptr);
+            if (((j - home) & mask) >= ((j - i) & mask)) {
+                profile_samples[i] = profile_samples[j];
+                i = j;
+            }
+        }
+        profile_samples[i].ptr = NULL;
+    }
+    pthread_mutex_unlock(&profile_lock);
+    
+    profile_set_mark(block, 0);
+}
+
+/* Start sampling; the tables are kept when profiling stops */
+int mem_profile_start(size_t sample_bytes) {
+    /* The unwinder allocates on first use, which must not happen while
+     * sampling inside an allocation */
+    void* pc;
+    backtrace(&pc, 1);
+    
+    pthread_mutex_lock(&profile_lock);
+    if (!profile_stacks) {
+        void* stacks = mmap(NULL, PROFILE_STACKS * sizeof(profile_stack_t), PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        void* samples = mmap(NULL, PROFILE_SAMPLES * sizeof(profile_sample_t), PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (stacks == MAP_FAILED || samples == MAP_FAILED) {
+            if (stacks != MAP_FAILED) {
+                munmap(stacks, PROFILE_STACKS * sizeof(profile_stack_t));
+            }
+            if (samples != MAP_FAILED) {
+                munmap(samples, PROFILE_SAMPLES * sizeof(profile_sample_t));
+            }
+            pthread_mutex_unlock(&profile_lock);
+            return -1;
+        }
+        profile_stacks = stacks;
+        profile_samples = samples;
+    }
+    pthread_mutex_unlock(&profile_lock);
+    
+    __atomic_store_n(&profile_rate, sample_bytes ? sample_bytes : PROFILE_DEFAULT_RATE, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Stop taking samples; live samples stay in the profile until freed */
+void mem_profile_stop(void) {
+    __atomic_store_n(&profile_rate, 0, __ATOMIC_RELEASE);
+}
+
+/* Buffered output to a file descriptor. Numbers are formatted here
+ * rather than with stdio, so writing needs no heap memory and is safe
+ * in a signal handler. */
+typedef struct {
+    int fd;
+    int error;
+    size_t len;
+    char buf[4096];
+} output_t;
+
+static void out_flush(output_t* out) {
+    size_t done = 0;
+    while (done < out->len && !out->error) {
+        ssize_t n = write(out->fd, out->buf + done, out->len - done);
+        if (n < 0 && errno != EINTR) {
+            out->error = errno;
+        } else if (n > 0) {
+            done += (size_t)n;
+        }
+    }
+    out->len = 0;
+}
+
+static void out_str(output_t* out, const char* s) {
+    for (; *s; s++) {
+        if (out->len == sizeof(out->buf)) {
+            out_flush(out);
+        }
+        out->buf[out->len++] = *s;
+    }
+}
+
+static void out_uint(output_t* out, uint64_t value) {
+    char digits[24];
+    char* p = digits + sizeof(digits) - 1;
+    *p = '\0';
+    do {
+        *--p = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    out_str(out, p);
+}
+
+static void out_hex(output_t* out, uint64_t value) {
+    char digits[24];
+    char* p = digits + sizeof(digits) - 1;
+    *p = '\0';
+    do {
+        *--p = "0123456789abcdef"[value & 15];
+        value >>= 4;
+    } while (value);
+    out_str(out, "0x");
+    out_str(out, p);
+}
+
+/* Non-negative fixed-point number with the given number of decimals */
+static void out_fixed(output_t* out, double value, int decimals) {
+    uint64_t scale = 1;
+    for (int i = 0; i < decimals; i++) {
+        scale *= 10;
+    }
+    uint64_t scaled = (uint64_t)(value * (double)scale + 0.5);
+    out_uint(out, scaled / scale);
+    if (decimals > 0) {
+        char digits[24];
+        uint64_t fraction = scaled % scale;
+        for (int i = decimals - 1; i >= 0; i--) {
+            digits[i + 1] = (char)('0' + fraction % 10);
+            fraction /= 10;
+        }
+        digits[0] = '.';
+        digits[decimals + 1] = '\0';
+        out_str(out, digits);
+    }
+}
+
+/* Close the output's descriptor; 0 or -1 with errno */
+static int out_close(output_t* out) {
+    out_flush(out);
+    if (close(out->fd) != 0 && !out->error) {
+        out->error = errno;
+    }
+    if (out->error) {
+        errno = out->error;
+        return -1;
+    }
+    return 0;
+}
+
+/* "live_count: live_bytes [alloc_count: alloc_bytes]" */
+static void profile_counts(output_t* out, size_t live_count, size_t live_bytes,
+                           size_t alloc_count, size_t alloc_bytes) {
+    out_uint(out, live_count);
+    out_str(out, ": ");
+    out_uint(out, live_bytes);
+    out_str(out, " [");
+    out_uint(out, alloc_count);
+    out_str(out, ": ");
+    out_uint(out, alloc_bytes);
+    out_str(out, "]");
+}
+
+/* Write the profile in pprof's legacy heap format: a header with totals
+ * and the sampling rate, one line per stack, then the memory map that
+ * pprof symbolizes addresses with */
+int mem_profile_dump(const char* path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    
+    output_t out = { .fd = fd };
+    pthread_mutex_lock(&profile_lock);
+    
+    size_t live_count = 0, live_bytes = 0, alloc_count = 0, alloc_bytes = 0;
+    for (size_t i = 0; profile_stacks && i < PROFILE_STACKS; i++) {
+        live_count += profile_stacks[i].live_count;
+        live_bytes += profile_stacks[i].live_bytes;
+        alloc_count += profile_stacks[i].alloc_count;
+        alloc_bytes += profile_stacks[i].alloc_bytes;
+    }
+    size_t rate = __atomic_load_n(&profile_rate, __ATOMIC_RELAXED);
+    out_str(&out, "heap profile: ");
+    profile_counts(&out, live_count, live_bytes, alloc_count, alloc_bytes);
+    out_str(&out, " @ heap_v2/");
+    out_uint(&out, rate ? rate : PROFILE_DEFAULT_RATE);
+    out_str(&out, "\n");
+    
+    for (size_t i = 0; profile_stacks && i < PROFILE_STACKS; i++) {
+        const profile_stack_t* s = &profile_stacks[i];
+        if (s->hash == 0) {
+            continue;
+        }
+        profile_counts(&out, s->live_count, s->live_bytes, s->alloc_count, s->alloc_bytes);
+        out_str(&out, " @");
+        for (int k = 0; k < s->depth; k++) {
+            out_str(&out, " ");
+            out_hex(&out, (uintptr_t)s->pcs[k]);
+        }
+        out_str(&out, "\n");
+    }
+    pthread_mutex_unlock(&profile_lock);
+    
+    out_str(&out, "\nMAPPED_LIBRARIES:\n");
+    out_flush(&out);
+    int maps = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+    if (maps >= 0) {
+        ssize_t n;
+        while (!out.error && (n = read(maps, out.buf, sizeof(out.buf))) > 0) {
+            out.len = (size_t)n;
+            out_flush(&out);
+        }
+        close(maps);
+    }
+    return out_close(&out);
+}
+
+static void profile_dump_at_exit(void) {
+    mem_profile_dump(profile_exit_path);
+}
+
+/* Dump the profile to path when the process exits */
+int mem_profile_dump_at_exit(const char* path) {
+    static int registered;
+    
+    if (strlen(path) >= sizeof(profile_exit_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    pthread_mutex_lock(&profile_lock);
+    strcpy(profile_exit_path, path);
+    int result = 0;
+    if (!registered) {
+        result = atexit(profile_dump_at_exit) == 0 ? 0 : -1;
+        registered = result == 0;
+    }
+    pthread_mutex_unlock(&profile_lock);
+    return result;
+}
+
+/* Latency histograms. Timestamps are TSC ticks on x86 (nanoseconds
+ * elsewhere), converted to nanoseconds when read using the tick rate
+ * observed since the histograms were enabled. Buckets are log-linear:
+ * values below 16 have their own bucket, larger ones 16 buckets per
+ * power of two, so a bucket is at most 1/16 of its values wide. Only the
+ * _ts functions record, under the allocator mutex, so updates need no
+ * atomic read-modify-write. */
+#define LATENCY_SUB_BITS 4
+#define LATENCY_MAX_EXP 47                /* Larger values share the last bucket */
+#define LATENCY_BUCKETS ((LATENCY_MAX_EXP - LATENCY_SUB_BITS + 2) << LATENCY_SUB_BITS)
+
+typedef struct {
+    size_t count;
+    size_t total;                   /* Ticks */
+    size_t max;
+    size_t buckets[LATENCY_BUCKETS];
+} latency_hist_t;
+
+static latency_hist_t latency_hists[MEM_LATENCY_OPS][MEM_PATHS];
+static int latency_enabled;
+static uint64_t latency_tsc0;       /* Ticks and time when first enabled */
+static uint64_t latency_ns0;
+
+/* Operation and path names used by the report and the exports */
+static const char* const latency_op_names[MEM_LATENCY_OPS] = { "malloc", "free" };
+static const char* const latency_path_names[MEM_PATHS] = { "fast", "free_list", "growth", "mmap" };
+
+static inline uint64_t latency_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static int latency_bucket(uint64_t ticks) {
+    if (ticks < (1u << LATENCY_SUB_BITS)) {
+        return (int)ticks;
+    }
+    int exp = 63 - __builtin_clzll(ticks);
+    if (exp > LATENCY_MAX_EXP) {
+        return LATENCY_BUCKETS - 1;
+    }
+    int sub = (int)(ticks >> (exp - LATENCY_SUB_BITS)) & ((1 << LATENCY_SUB_BITS) - 1);
+    return ((exp - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS) + sub;
+}
+
+/* Largest value that falls in a bucket */
+static uint64_t latency_bucket_max(int bucket) {
+    if (bucket < (1 << LATENCY_SUB_BITS)) {
+        return (uint64_t)bucket;
+    }
+    int exp = (bucket >> LATENCY_SUB_BITS) + LATENCY_SUB_BITS - 1;
+    uint64_t sub = (uint64_t)(bucket & ((1 << LATENCY_SUB_BITS) - 1));
+    uint64_t width = 1ULL << (exp - LATENCY_SUB_BITS);
+    return (((1ULL << LATENCY_SUB_BITS) + sub) << (exp - LATENCY_SUB_BITS)) + width - 1;
+}
+
+/* Writers hold the allocator mutex; readers may not */
+static inline void latency_store(size_t* counter, size_t value) {
+    __atomic_store_n(counter, value, __ATOMIC_RELAXED);
+}
+
+/* Start timing an operation; 0 when the histograms are off */
+unsigned long long mem_latency_begin(void) {
+    if (__atomic_load_n(&latency_enabled, __ATOMIC_RELAXED)) {
+        last_path = NO_PATH;
+        return latency_ticks() | 1;
+    }
+    return 0;
+}
+
+/* Record an operation begun at start, with the path it took */
+void mem_latency_end(int op, unsigned long long start) {
+    if (!start || last_path == NO_PATH) {
+        return;
+    }
+    uint64_t ticks = latency_ticks() - start;
+    latency_hist_t* hist = &latency_hists[op][last_path];
+    latency_store(&hist->count, hist->count + 1);
+    latency_store(&hist->total, hist->total + ticks);
+    size_t* bucket = &hist->buckets[latency_bucket(ticks)];
+    latency_store(bucket, *bucket + 1);
+    if (ticks > hist->max) {
+        latency_store(&hist->max, ticks);
+    }
+}
+
+/* Histograms stay empty when statistics are compiled out */
+void mem_latency_enable(int enable) {
+#ifndef MEM_DISABLE_STATS
+    if (enable && !__atomic_load_n(&latency_tsc0, __ATOMIC_ACQUIRE)) {
+        latency_ns0 = now_ns();
+        __atomic_store_n(&latency_tsc0, latency_ticks(), __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&latency_enabled, enable != 0, __ATOMIC_RELAXED);
+#else
+    (void)enable;
+#endif
+}
+
+/* Nanoseconds per tick, measured since the histograms were enabled */
+static double latency_ns_per_tick(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    uint64_t tsc0 = __atomic_load_n(&latency_tsc0, __ATOMIC_ACQUIRE);
+    uint64_t ticks = latency_ticks() - tsc0;
+    uint64_t ns = now_ns() - latency_ns0;
+    return tsc0 && ticks ? (double)ns / (double)ticks : 0;
+#else
+    return 1;
+#endif
+}
+
+/* Sum an operation's histograms over one path, or all of them */
+static void latency_collect(int op, int path, latency_hist_t* out) {
+    memset(out, 0, sizeof(*out));
+    if (op < 0 || op >= MEM_LATENCY_OPS || path < MEM_PATH_ALL || path >= MEM_PATHS) {
+        return;
+    }
+    for (int p = 0; p < MEM_PATHS; p++) {
+        if (path != MEM_PATH_ALL && p != path) {
+            continue;
+        }
+        const latency_hist_t* h = &latency_hists[op][p];
+        out->count += STAT_READ(h->count);
+        out->total += STAT_READ(h->total);
+        size_t max = STAT_READ(h->max);
+        out->max = max > out->max ? max : out->max;
+        for (int b = 0; b < LATENCY_BUCKETS; b++) {
+            out->buckets[b] += STAT_READ(h->buckets[b]);
+        }
+    }
+}
+
+/* Ticks at or below which percentile % of the operations fall (the
+ * upper end of that bucket, capped at the maximum seen) */
+static double latency_quantile(const latency_hist_t* hist, double percentile) {
+    if (hist->count == 0) {
+        return 0;
+    }
+    size_t rank = (size_t)(percentile / 100.0 * (double)hist->count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    size_t seen = 0;
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += hist->buckets[b];
+        if (seen >= rank) {
+            uint64_t value = latency_bucket_max(b);
+            return (double)(value < hist->max ? value : hist->max);
+        }
+    }
+    return (double)hist->max;
+}
+
+/* Latency percentile of an operation on a path (MEM_PATH_ALL for all) */
+double mem_latency_percentile(int op, int path, double percentile) {
+    latency_hist_t hist;
+    latency_collect(op, path, &hist);
+    return latency_quantile(&hist, percentile) * latency_ns_per_tick();
+}
+
+/* Latency summary of an operation on a path (MEM_PATH_ALL for all) */
+mem_latency_stats_t mem_get_latency(int op, int path) {
+    latency_hist_t hist;
+    mem_latency_stats_t stats = {0};
+    latency_collect(op, path, &hist);
+    if (hist.count == 0) {
+        return stats;
+    }
+    
+    double scale = latency_ns_per_tick();
+    stats.count = hist.count;
+    stats.mean_ns = (double)hist.total / (double)hist.count * scale;
+    stats.p50_ns = latency_quantile(&hist, 50) * scale;
+    stats.p90_ns = latency_quantile(&hist, 90) * scale;
+    stats.p99_ns = latency_quantile(&hist, 99) * scale;
+    stats.p999_ns = latency_quantile(&hist, 99.9) * scale;
+    stats.max_ns = (double)hist.max * scale;
+    return stats;
+}
+
+/* A thread that forks while another holds shard_lock or profile_lock
+ * must not leave the child with it locked. These are called by the
+ * atfork handlers in allocator_ts.c with the allocator mutex held, since
+ * both locks are taken under it (shard_acquire, profile_sample). */
+void mem_fork_prepare_locks(void) {
+    pthread_mutex_lock(&shard_lock);
+    pthread_mutex_lock(&profile_lock);
+}
+
+void mem_fork_parent_unlock(void) {
+    pthread_mutex_unlock(&profile_lock);
+    pthread_mutex_unlock(&shard_lock);
+}
+
+void mem_fork_child_reset(void) {
+    pthread_mutex_init(&shard_lock, NULL);
+    pthread_mutex_init(&profile_lock, NULL);
+}
+
+/* Find suitable free block */
+static block_header_t* find_free_block(heap_t* h, size_t size) {
+    int start_class = get_size_class(size);
+    
+    /* Search in appropriate size class and larger ones */
+    for (int i = start_class; i < NUM_SIZE_CLASSES; i++) {
+        block_header_t* current = hptr(h, h->free_lists[i]);
+        
+        while (current) {
+            if (current->is_free && current->size >= size) {
+                return current;
+            }
+            current = hptr(h, current->next);
+        }
+    }
+    
+    return NULL;
+}
+
+/* Allocate from a specific heap */
+static void* heap_malloc(heap_t* h, size_t size) {
+    if (size == 0 || h == NULL) {
+        return NULL;
+    }
+    /* Sizes whose block or mapping length would wrap around */
+    if (size > PTRDIFF_MAX || size > SIZE_MAX - sizeof(block_header_t) - page_size()) {
+        return NULL;
+    }
+    
+    size_t total_size = align_size(size + sizeof(block_header_t));
+    block_header_t* block;
+    
+    if (total_size >= HUGE_THRESHOLD && h->backend < HEAP_FIXED) {
+        /* Use mmap for huge allocations */
+        SET_PATH(MEM_PATH_MMAP);
+        block = huge_alloc(h, total_size);
+    } else if (total_size >= MMAP_THRESHOLD && h->backend < HEAP_FIXED) {
+        /* Carve large allocations from extent regions */
+        SET_PATH(MEM_PATH_MMAP);
+        block = extent_alloc(h, total_size);
+    } else {
+        /* Try to find free block */
+        SET_PATH(MEM_PATH_FREE_LIST);
+        block = find_free_block(h, total_size);
+        
+        if (block) {
+            /* Remove from free list */
+            remove_from_free_list(h, block);
+            
+            /* Split if block is too large */
+            split_block(h, block, size);
+        } else {
+            /* No suitable free block, carve from the top chunk */
+            block = carve_top(h, total_size);
+        }
+    }
+    
+    if (!block) {
+        return NULL;
+    }
+    block->is_free = 0;
+    count_alloc(h, size, block->size);
+    
+    return (void*)((char*)block + sizeof(block_header_t));
+}
+
+/* Return a block to its heap (statistics are the caller's) */
+static void release_block(heap_t* h, block_header_t* block) {
+    if (block->is_mmap == BLOCK_MMAP) {
+        /* Unmap huge allocation */
+        SET_PATH(MEM_PATH_MMAP);
+        huge_free(h, block);
+        return;
+    }
+    
+    if (block->is_mmap == BLOCK_EXTENT) {
+        /* Return large allocation to its extent region */
+        SET_PATH(MEM_PATH_MMAP);
+        extent_free(block);
+        return;
+    }
+    
+    SET_PATH(MEM_PATH_FREE_LIST);
+    /* Coalesce with adjacent free blocks */
+    block->is_free = 1;
+    block = coalesce(h, block);
+    
+    /* Add to appropriate free list, unless absorbed by the top chunk */
+    if (block != hptr(h, h->top)) {
+        add_to_free_list(h, block);
+    }
+}
+
+/* Free a block; h is the owning heap, or NULL to look it up */
+static void heap_free(heap_t* h, void* ptr) {
+    if (!ptr) {
+        return;
+    }
+    
+    block_header_t* block = ptr_block(ptr);
+    if (!h) {
+        h = block_heap(block);
+    }
+    
+    count_free(h, block->size);
+    if (__builtin_expect(profile_marked(block), 0)) {
+        profile_forget(block, ptr);
+    }
+    release_block(h, block);
+}
+
+/* Zeroed allocation from a specific heap */
+static void* heap_calloc(heap_t* h, size_t nmemb, size_t size) {
+    if (nmemb == 0 || size == 0) {
+        return NULL;
+    }
+    
+    /* Check for overflow */
+    size_t total = nmemb * size;
+    if (total / nmemb != size) {
+        return NULL;  /* Overflow */
+    }
+    
+    void* ptr = heap_malloc(h, total);
+    if (ptr) {
+        memset(ptr, 0, total);
+    }
+    
+    return ptr;
+}
+
+/* Resize within a specific heap; h NULL means the default heaps */
+static void* heap_realloc(heap_t* h, void* ptr, size_t size) {
+    if (!ptr) {
+        return heap_malloc(h ? h : local_heap(), size);
+    }
+    
+    if (size == 0) {
+        heap_free(h, ptr);
+        return NULL;
+    }
+    
+    size_t old_size = usable_size(ptr);
+    
+    if (old_size >= size) {
+        /* Current block is large enough */
+        SET_PATH(MEM_PATH_FREE_LIST);
+        return ptr;
+    }
+    
+    /* Allocate new block and copy data */
+    void* new_ptr = heap_malloc(h ? h : local_heap(), size);
+    if (!new_ptr) {
+        return NULL;
+    }
+    
+    memcpy(new_ptr, ptr, old_size);
+    heap_free(h, ptr);
+    
+    return new_ptr;
+}
+
+/* Allocation aligned beyond ALIGNMENT: over-allocate, and put a
+ * placeholder header in front of the aligned pointer that leads back
+ * to the real block */
+static void* heap_memalign(heap_t* h, size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (alignment <= ALIGNMENT) {
+        return heap_malloc(h, size);
+    }
+    if (size == 0 || size > SIZE_MAX - alignment - sizeof(block_header_t)) {
+        return NULL;
+    }
+    
+    char* raw = heap_malloc(h, size + alignment + sizeof(block_header_t));
+    if (!raw || ((uintptr_t)raw & (alignment - 1)) == 0) {
+        return raw;
+    }
+    
+    char* aligned = (char*)(((uintptr_t)raw + sizeof(block_header_t) + alignment - 1) & ~(uintptr_t)(alignment - 1));
+    block_header_t* placeholder = (block_header_t*)(aligned - sizeof(block_header_t));
+    placeholder->size = (size_t)(aligned - raw);
+    placeholder->is_free = 0;
+    placeholder->is_mmap = BLOCK_ALIGNED;
+    placeholder->next = 0;
+    placeholder->prev = 0;
+    
+    return aligned;
+}
+
+/* Block size of a fast cache class */
+static size_t fast_block_size(int cls) {
+    return (size_t)(cls + 1) * 16 + sizeof(block_header_t);
+}
+
+/* Keep a freed block for reuse by an allocation of exactly its size.
+ * Cached blocks stay marked allocated, so nothing coalesces with them;
+ * they count as freed in the statistics. Only the single default heap
+ * caches: on NUMA machines a cached block could be on another node. */
+static int fast_cache_push(void* ptr) {
+    block_header_t* block = ptr_block(ptr);
+    size_t usable = block->size - sizeof(block_header_t);
+    
+    if (block->is_mmap != BLOCK_HEAP || numa_nodes > 1 || usable > MEM_FAST_MAX ||
+        block->prev == PROFILE_MARK) {
+        return 0;
+    }
+    int cls = (int)(usable / 16) - 1;
+    if (mem_fast_cache.count[cls] >= MEM_FAST_LIMIT) {
+        return 0;
+    }
+    
+    STAT_ADD(mem_fast_cache.frees[cls], 1);
+    SET_PATH(MEM_PATH_FAST);
+    
+    void* user = (char*)block + sizeof(block_header_t);
+    *(void**)user = mem_fast_cache.head[cls];
+    mem_fast_cache.head[cls] = user;
+    mem_fast_cache.count[cls]++;
+    return 1;
+}
+
+/* Return every cached block to the default heap */
+static void fast_cache_flush(void) {
+    for (int cls = 0; cls < MEM_FAST_CLASSES; cls++) {
+        void* user = mem_fast_cache.head[cls];
+        while (user) {
+            void* next = *(void**)user;
+            release_block(&main_heap, (block_header_t*)((char*)user - sizeof(block_header_t)));
+            user = next;
+        }
+        mem_fast_cache.head[cls] = NULL;
+        mem_fast_cache.count[cls] = 0;
+    }
+}
+
+/* Thread-unsafe malloc implementation */
+MEM_ENTRY void* mem_malloc(size_t size) {
+    if (size - 1 < MEM_FAST_MAX) {
+        size_t cls = (size - 1) / 16;
+        void* ptr = mem_fast_cache.head[cls];
+        if (ptr) {
+            mem_fast_cache.head[cls] = *(void**)ptr;
+            mem_fast_cache.count[cls]--;
+            STAT_ADD(mem_fast_cache.hits[cls], 1);
+            STAT_ADD(mem_fast_cache.requested[cls], size);
+            SET_PATH(MEM_PATH_FAST);
+            return profile_count(ptr, size);
+        }
+    }
+    return profile_count(heap_malloc(local_heap(), size), size);
+}
+
+/* Thread-unsafe malloc from a specific NUMA node */
+MEM_ENTRY void* mem_malloc_onnode(size_t size, int node) {
+    return profile_count(heap_malloc(node_heap(node), size), size);
+}
+
+/* Thread-unsafe free implementation */
+void mem_free(void* ptr) {
+    if (ptr && fast_cache_push(ptr)) {
+        return;
+    }
+    heap_free(NULL, ptr);
+}
+
+/* Thread-unsafe calloc implementation */
+MEM_ENTRY void* mem_calloc(size_t nmemb, size_t size) {
+    void* ptr = heap_calloc(local_heap(), nmemb, size);
+    return ptr ? profile_count(ptr, nmemb * size) : NULL;
+}
+
+/* Thread-unsafe realloc implementation (a block resized in place keeps
+ * its profile sample) */
+MEM_ENTRY void* mem_realloc(void* ptr, size_t size) {
+    void* new_ptr = heap_realloc(NULL, ptr, size);
+    return new_ptr && new_ptr != ptr ? profile_count(new_ptr, size) : new_ptr;
+}
+
+/* Thread-unsafe aligned allocation */
+MEM_ENTRY void* mem_memalign(size_t alignment, size_t size) {
+    return profile_count(heap_memalign(local_heap(), alignment, size), size);
+}
+
+/* Usable size of an allocation (at least the size requested) */
+size_t mem_usable_size(void* ptr) {
+    return ptr ? usable_size(ptr) : 0;
+}
+
+/* Create an isolated heap in its own reserved address range. The heap
+ * state lives in the first page of the range. */
+mem_heap_t* mem_heap_create(void) {
+    char* base = mmap(NULL, HEAP_RESERVE, PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+    if (mprotect(base, page_size(), PROT_READ | PROT_WRITE) != 0) {
+        munmap(base, HEAP_RESERVE);
+        return NULL;
+    }
+    
+    heap_t* h = (heap_t*)base;
+    memset(h, 0, sizeof(*h));
+    h->heap_start = hoff(h, base + page_size());
+    h->heap_end = h->heap_start;
+    h->reserve_end = HEAP_RESERVE;
+    h->backend = HEAP_REGION;
+    h->node = -1;
+    h->stats.num_mappings = 1;
+    
+    return h;
+}
+
+/* Set up a fixed heap whose blocks span [start, end); the whole range
+ * starts out as the top chunk */
+static void fixed_heap_init(heap_t* h, char* start, char* end, int backend) {
+    memset(h, 0, sizeof(*h));
+    h->heap_start = hoff(h, start);
+    h->heap_end = hoff(h, end);
+    h->reserve_end = h->heap_end;
+    h->heap_size = (size_t)(end - start);
+    h->backend = backend;
+    h->node = -1;
+    
+    block_header_t* top = (block_header_t*)start;
+    top->size = h->heap_size;
+    top->is_free = 1;
+    top->is_mmap = BLOCK_HEAP;
+    top->next = 0;
+    top->prev = 0;
+    h->top = hoff(h, top);
+}
+
+/* Create a heap that manages a caller-provided buffer. The heap state
+ * sits at the start of the buffer and the rest becomes the top chunk;
+ * the heap never grows and makes no sbrk or mmap calls. */
+mem_heap_t* mem_heap_create_in(void* buffer, size_t size) {
+    if (!buffer) {
+        errno = EINVAL;
+        return NULL;
+    }
+    
+    char* base = (char*)align_size((uintptr_t)buffer);
+    char* start = base + align_size(sizeof(heap_t));
+    char* end = (char*)(((uintptr_t)buffer + size) & ~(uintptr_t)(ALIGNMENT - 1));
+    if (end < start || (size_t)(end - start) < sizeof(block_header_t) + MIN_BLOCK_SIZE) {
+        errno = EINVAL;
+        return NULL;
+    }
+    
+    heap_t* h = (heap_t*)base;
+    fixed_heap_init(h, start, end, HEAP_FIXED);
+    return h;
+}
+
+/* Get the shared mapping header of a HEAP_SHARED heap */
+static shared_heap_t* shared_of(heap_t* h) {
+    return (shared_heap_t*)((char*)h - offsetof(shared_heap_t, heap));
+}
+
+/* Lock a shared heap against other processes (no-op for other heaps).
+ * If the previous owner died holding the lock, its operation may be
+ * half done: rebuild the free lists from the block headers first. */
+static void heap_lock(heap_t* h) {
+    if (h->backend != HEAP_SHARED) {
+        return;
+    }
+    pthread_mutex_t* lock = &shared_of(h)->lock;
+    if (pthread_mutex_lock(lock) == EOWNERDEAD) {
+        rebuild_free_lists(h);
+        pthread_mutex_consistent(lock);
+    }
+}
+
+/* Unlock a shared heap */
+static void heap_unlock(heap_t* h) {
+    if (h->backend == HEAP_SHARED) {
+        pthread_mutex_unlock(&shared_of(h)->lock);
+    }
+}
+
+/* Initialize the process-shared robust lock of a shared heap */
+static void shared_lock_init(pthread_mutex_t* lock) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+/* Create a heap in a shared memory object (from memfd_create or shm_open).
+ * The object is resized to size bytes and initialized; other processes
+ * attach to it with mem_heap_attach_shared(). */
+mem_heap_t* mem_heap_create_shared(int fd, size_t size) {
+    size = (size + page_size() - 1) & ~(page_size() - 1);
+    size_t start_off = align_size(sizeof(shared_heap_t));
+    if (size < start_off + sizeof(block_header_t) + MIN_BLOCK_SIZE) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (ftruncate(fd, (off_t)size) != 0) {
+        return NULL;
+    }
+    
+    shared_heap_t* sh = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (sh == MAP_FAILED) {
+        return NULL;
+    }
+    
+    shared_lock_init(&sh->lock);
+    sh->size = size;
+    sh->persistent = 0;
+    sh->dirty = 0;
+    sh->openers = 0;
+    fixed_heap_init(&sh->heap, (char*)sh + start_off, (char*)sh + size, HEAP_SHARED);
+    __atomic_store_n(&sh->magic, SHARED_HEAP_MAGIC, __ATOMIC_RELEASE);
+    
+    return &sh->heap;
+}
+
+/* Map an existing shared heap into this process, at any address */
+mem_heap_t* mem_heap_attach_shared(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return NULL;
+    }
+    if ((size_t)st.st_size < sizeof(shared_heap_t)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    
+    size_t size = (size_t)st.st_size;
+    shared_heap_t* sh = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (sh == MAP_FAILED) {
+        return NULL;
+    }
+    if (__atomic_load_n(&sh->magic, __ATOMIC_ACQUIRE) != SHARED_HEAP_MAGIC || sh->size != size) {
+        munmap(sh, size);
+        errno = EINVAL;
+        return NULL;
+    }
+    
+    return &sh->heap;
+}
+
+/* Byte-range locks on a heap file. Openers serialize on FILE_LOCK_OPEN;
+ * every open handle keeps a read lock on FILE_LOCK_USERS. These are open
+ * file description locks, so the mapping (which holds the description)
+ * keeps the read lock after the fd is closed, until it is unmapped or its
+ * process dies, and two handles in one process still see each other. */
+#define FILE_LOCK_OPEN 0
+#define FILE_LOCK_USERS 1
+
+static int file_lock(int fd, int byte, short type, int wait) {
+    struct flock fl = { .l_type = type, .l_whence = SEEK_SET, .l_start = byte, .l_len = 1 };
+    return fcntl(fd, wait ? F_OFD_SETLKW : F_OFD_SETLK, &fl);
+}
+
+/* Open a persistent heap stored in a file, creating it with size bytes
+ * if it is empty. Blocks and metadata hold only offsets, so the heap is
+ * usable as soon as it is mapped. If no other handle is open and the last
+ * user did not close it cleanly, the lock is reset and the free lists
+ * are rebuilt first. */
+mem_heap_t* mem_heap_open_file(const char* path, size_t size) {
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (file_lock(fd, FILE_LOCK_OPEN, F_WRLCK, 1) != 0) {
+        close(fd);
+        return NULL;
+    }
+    
+    struct stat st;
+    heap_t* h = NULL;
+    if (fstat(fd, &st) == 0) {
+        h = st.st_size == 0 ? mem_heap_create_shared(fd, size) : mem_heap_attach_shared(fd);
+    }
+    
+    if (h) {
+        shared_heap_t* sh = shared_of(h);
+        if (file_lock(fd, FILE_LOCK_USERS, F_WRLCK, 0) == 0) {
+            /* No live handle: the lock and the count are left over from
+             * processes that died, and nobody can be using them */
+            if (sh->dirty) {
+                shared_lock_init(&sh->lock);
+                rebuild_free_lists(h);
+            }
+            sh->openers = 0;
+        }
+        if (file_lock(fd, FILE_LOCK_USERS, F_RDLCK, 0) == 0) {
+            heap_lock(h);
+            sh->openers++;
+            sh->persistent = 1;
+            sh->dirty = 1;
+            heap_unlock(h);
+        } else {
+            munmap(sh, sh->size);
+            h = NULL;
+        }
+    }
+    
+    /* The mapping keeps the file open, and with it the read lock */
+    file_lock(fd, FILE_LOCK_OPEN, F_UNLCK, 0);
+    close(fd);
+    return h;
+}
+
+/* Set the heap's root object, the entry point for finding data again
+ * after a persistent heap is reopened */
+void mem_heap_set_root(mem_heap_t* h, void* ptr) {
+    heap_lock(h);
+    h->root = hoff(h, ptr);
+    heap_unlock(h);
+}
+
+/* Get the heap's root object */
+void* mem_heap_get_root(mem_heap_t* h) {
+    heap_lock(h);
+    void* root = hptr(h, h->root);
+    heap_unlock(h);
+    return root;
+}
+
+/* Offset of a heap pointer, valid in every process attached to the heap */
+size_t mem_heap_offset(mem_heap_t* h, const void* ptr) {
+    return (size_t)hoff(h, ptr);
+}
+
+/* Pointer for an offset returned by mem_heap_offset() */
+void* mem_heap_pointer(mem_heap_t* h, size_t offset) {
+    return hptr(h, (heap_off_t)offset);
+}
+
+/* Destroy a heap, releasing all of its memory at once */
+void mem_heap_destroy(mem_heap_t* h) {
+    if (!h || h->backend == HEAP_FIXED) {
+        return;  /* The buffer belongs to the caller */
+    }
+    if (h->backend == HEAP_SHARED) {
+        /* Only this process's view; the object lives until its last user */
+        shared_heap_t* sh = shared_of(h);
+        size_t size = sh->size;
+        if (sh->persistent) {
+            heap_lock(h);
+            int last = sh->openers <= 1;
+            if (sh->openers > 0) {
+                sh->openers--;
+            }
+            heap_unlock(h);
+            
+            /* The last handle writes everything back, then marks the file
+             * clean unless another handle was opened meanwhile */
+            if (last) {
+                msync(sh, size, MS_SYNC);
+                heap_lock(h);
+                if (sh->openers == 0) {
+                    sh->dirty = 0;
+                }
+                heap_unlock(h);
+                msync(sh, page_size(), MS_SYNC);
+            }
+        }
+        munmap(sh, size);  /* Drops this handle's read lock */
+        return;
+    }
+    
+    while (h->huge_blocks) {
+        huge_free(h, hptr(h, h->huge_blocks));
+    }
+    
+    extent_region_t* region = h->regions;
+    while (region) {
+        extent_region_t* next = region->next;
+        munmap(region, EXTENT_REGION_SIZE);
+        region = next;
+    }
+    
+    munmap(h, HEAP_RESERVE);
+}
+
+/* Allocate from a heap instance */
+void* mem_heap_malloc(mem_heap_t* h, size_t size) {
+    heap_lock(h);
+    void* ptr = heap_malloc(h, size);
+    heap_unlock(h);
+    return ptr;
+}
+
+/* Free memory allocated from a heap instance */
+void mem_heap_free(mem_heap_t* h, void* ptr) {
+    heap_lock(h);
+    heap_free(h, ptr);
+    heap_unlock(h);
+}
+
+/* Zeroed allocation from a heap instance */
+void* mem_heap_calloc(mem_heap_t* h, size_t nmemb, size_t size) {
+    heap_lock(h);
+    void* ptr = heap_calloc(h, nmemb, size);
+    heap_unlock(h);
+    return ptr;
+}
+
+/* Resize memory allocated from a heap instance */
+void* mem_heap_realloc(mem_heap_t* h, void* ptr, size_t size) {
+    heap_lock(h);
+    void* new_ptr = heap_realloc(h, ptr, size);
+    heap_unlock(h);
+    return new_ptr;
+}
+
+/* Aligned allocation from a heap instance */
+void* mem_heap_memalign(mem_heap_t* h, size_t alignment, size_t size) {
+    heap_lock(h);
+    void* ptr = heap_memalign(h, alignment, size);
+    heap_unlock(h);
+    return ptr;
+}
+
+/* Add call counters into totals */
+static void add_calls(call_counters_t* totals, call_counters_t* c) {
+    for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+        class_counters_t* cc = &c->classes[i];
+        totals->classes[i].num_allocations += STAT_READ(cc->num_allocations);
+        totals->classes[i].num_frees += STAT_READ(cc->num_frees);
+        totals->classes[i].requested_bytes += STAT_READ(cc->requested_bytes);
+        totals->classes[i].granted_bytes += STAT_READ(cc->granted_bytes);
+        totals->classes[i].freed_bytes += STAT_READ(cc->freed_bytes);
+    }
+}
+
+/* Fill the call-counter fields of stats */
+static void export_calls(mem_stats_t* stats, const call_counters_t* c) {
+    for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+        const class_counters_t* cc = &c->classes[i];
+        stats->total_allocated += cc->granted_bytes;
+        stats->total_freed += cc->freed_bytes;
+        stats->current_usage += cc->granted_bytes - cc->freed_bytes;
+        stats->num_allocations += cc->num_allocations;
+        stats->num_frees += cc->num_frees;
+    }
+}
+
+/* Get a heap instance's statistics */
+mem_stats_t mem_heap_get_stats(mem_heap_t* h) {
+    call_counters_t calls = {0};
+    heap_lock(h);
+    mem_stats_t stats = h->stats;
+    add_calls(&calls, &h->calls);
+    heap_unlock(h);
+    export_calls(&stats, &calls);
+    return stats;
+}
+
+/* Convert size-class counters to the public form */
+static int export_class_stats(const class_counters_t* counters, mem_class_stats_t* stats, int max_classes) {
+    for (int i = 0; i < NUM_SIZE_CLASSES && i < max_classes; i++) {
+        const class_counters_t* c = &counters[i];
+        stats[i].max_block_size = i < NUM_SIZE_CLASSES - 1 ? (size_t)32 << i : SIZE_MAX;
+        stats[i].num_allocations = c->num_allocations;
+        stats[i].num_frees = c->num_frees;
+        stats[i].live_blocks = c->num_allocations - c->num_frees;
+        stats[i].live_bytes = c->granted_bytes - c->freed_bytes;
+        stats[i].requested_bytes = c->requested_bytes;
+        stats[i].granted_bytes = c->granted_bytes;
+    }
+    return NUM_SIZE_CLASSES;
+}
+
+/* Get a heap instance's per-size-class statistics */
+int mem_heap_get_class_stats(mem_heap_t* h, mem_class_stats_t* stats, int max_classes) {
+    call_counters_t calls = {0};
+    heap_lock(h);
+    add_calls(&calls, &h->calls);
+    heap_unlock(h);
+    return export_class_stats(calls.classes, stats, max_classes);
+}
+
+/* Add a heap's free space and block counts to info */
+static void add_heap_info(heap_t* h, mem_heap_info_t* info) {
+    if (!h->heap_start) {
+        return;
+    }
+    info->heap_size += h->heap_size;
+    
+    for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+        for (block_header_t* b = hptr(h, h->free_lists[i]); b; b = hptr(h, b->next)) {
+            info->bin_free_bytes[i] += b->size;
+            info->bin_free_blocks[i]++;
+            info->free_bytes += b->size;
+            info->free_blocks++;
+            if (b->size > info->largest_free_block) {
+                info->largest_free_block = b->size;
+            }
+        }
+    }
+    
+    block_header_t* top = hptr(h, h->top);
+    if (top) {
+        info->top_bytes += top->size;
+        info->free_bytes += top->size;
+        if (top->size > info->largest_free_block) {
+            info->largest_free_block = top->size;
+        }
+    }
+    
+    /* Allocated blocks, up to the top chunk (fences are not allocations) */
+    char* end = hptr(h, h->heap_end);
+    for (char* p = hptr(h, h->heap_start); p < end; p += ((block_header_t*)p)->size) {
+        block_header_t* block = (block_header_t*)p;
+        if (block == top) {
+            break;
+        }
+        if (!block->is_free && block->is_mmap == BLOCK_HEAP) {
+            info->live_blocks++;
+            info->header_bytes += sizeof(block_header_t);
+        }
+    }
+}
+
+/* Bytes of live blocks beyond what callers asked for, assuming each
+ * class's live blocks waste what its blocks have wasted on average */
+static size_t estimate_overhead(const call_counters_t* calls) {
+    double overhead = 0;
+    for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+        const class_counters_t* c = &calls->classes[i];
+        if (c->granted_bytes > c->requested_bytes) {
+            double live = (double)(c->granted_bytes - c->freed_bytes);
+            overhead += live * (double)(c->granted_bytes - c->requested_bytes) / (double)c->granted_bytes;
+        }
+    }
+    return (size_t)overhead;
+}
+
+static void finish_heap_info(mem_heap_info_t* info, const call_counters_t* calls) {
+    if (info->free_bytes) {
+        info->fragmentation = 1.0 - (double)info->largest_free_block / (double)info->free_bytes;
+    }
+    info->overhead_bytes = estimate_overhead(calls);
+}
+
+/* Get a heap instance's free space and fragmentation */
+mem_heap_info_t mem_heap_get_info(mem_heap_t* h) {
+    mem_heap_info_t info = {0};
+    call_counters_t calls = {0};
+    heap_lock(h);
+    add_heap_info(h, &info);
+    add_calls(&calls, &h->calls);
+    heap_unlock(h);
+    finish_heap_info(&info, &calls);
+    return info;
+}
+
+/* Fault in a range ahead of use; falls back to touching each page on
+ * kernels without MADV_POPULATE_WRITE */
+static void prefault_range(void* addr, size_t len) {
+    uintptr_t start = (uintptr_t)addr & ~(uintptr_t)(page_size() - 1);
+    uintptr_t end = (uintptr_t)addr + len;
+    
+    if (madvise((void*)start, end - start, MADV_POPULATE_WRITE) == 0) {
+        return;
+    }
+    
+    madvise((void*)start, end - start, MADV_WILLNEED);
+    for (volatile char* p = addr; (uintptr_t)p < end; p += page_size()) {
+        *p = 0;
+    }
+}
+
+/* Grow the local heap's top chunk up front */
+int mem_reserve(size_t bytes, int flags) {
+    heap_t* h = local_heap();
+    if (bytes == 0 || h == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    
+    char* start = expand_heap(h, bytes);
+    if (!start) {
+        return -1;
+    }
+    
+    size_t len = (size_t)((char*)hptr(h, h->heap_end) - start);
+    int result = 0;
+    if (flags & MEM_RESERVE_PREFAULT) {
+        prefault_range(start, len);
+    }
+    if ((flags & MEM_RESERVE_LOCK) && mlock(start, len) != 0) {
+        result = -1;  /* Memory is still usable, just not locked */
+    }
+    
+    return result;
+}
+
+/* Release unused memory at the top of every heap */
+size_t mem_trim(size_t pad) {
+    fast_cache_flush();
+    size_t released = trim_heap(&main_heap, pad);
+    for (int node = 0; node < MAX_NUMA_NODES; node++) {
+        released += trim_heap(&node_heaps[node], pad);
+    }
+    return released;
+}
+
+/* Set the heap growth policy; zero fields keep their current value */
+void mem_set_growth_policy(const mem_growth_policy_t* policy) {
+    if (policy->min_increment) {
+        growth_policy.min_increment = policy->min_increment;
+    }
+    if (policy->max_increment) {
+        growth_policy.max_increment = policy->max_increment;
+    }
+    if (policy->growth_percent) {
+        growth_policy.growth_percent = policy->growth_percent;
+    }
+    if (growth_policy.max_increment < growth_policy.min_increment) {
+        growth_policy.max_increment = growth_policy.min_increment;
+    }
+}
+
+/* Get the heap growth policy */
+mem_growth_policy_t mem_get_growth_policy(void) {
+    return growth_policy;
+}
+
+/* Number of NUMA nodes in use (1 on non-NUMA machines) */
+int mem_numa_nodes(void) {
+    if (numa_nodes == 0) {
+        numa_init();
+    }
+    return numa_nodes;
+}
+
+/* Call counters of the default heaps: every thread's shard, plus
+ * fast-path cache hits and the frees that refilled the cache */
+static void default_calls(call_counters_t* calls) {
+    int shards = __atomic_load_n(&num_stat_shards, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < shards; i++) {
+        add_calls(calls, &stat_shards[i].calls);
+    }
+    add_calls(calls, &overflow_shard.calls);
+    
+    for (int cls = 0; cls < MEM_FAST_CLASSES; cls++) {
+        size_t hits = STAT_READ(mem_fast_cache.hits[cls]);
+        size_t frees = STAT_READ(mem_fast_cache.frees[cls]);
+        class_counters_t* c = &calls->classes[get_size_class(fast_block_size(cls))];
+        c->num_allocations += hits;
+        c->requested_bytes += STAT_READ(mem_fast_cache.requested[cls]);
+        c->granted_bytes += hits * fast_block_size(cls);
+        c->num_frees += frees;
+        c->freed_bytes += frees * fast_block_size(cls);
+    }
+}
+
+/* Get statistics (summed over the default heaps) */
+mem_stats_t mem_get_stats(void) {
+    mem_stats_t total = main_heap.stats;
+    
+    for (int node = 0; node < MAX_NUMA_NODES; node++) {
+        const mem_stats_t* s = &node_heaps[node].stats;
+        total.num_splits += s->num_splits;
+        total.num_coalesces += s->num_coalesces;
+        total.num_expansions += s->num_expansions;
+        total.growth_ns += s->growth_ns;
+        total.num_mappings += s->num_mappings;
+    }
+    
+    call_counters_t calls = {0};
+    default_calls(&calls);
+    export_calls(&total, &calls);
+    for (int cls = 0; cls < MEM_FAST_CLASSES; cls++) {
+        total.num_fast_hits += STAT_READ(mem_fast_cache.hits[cls]);
+    }
+    
+    return total;
+}
+
+/* Get the default heaps' free space and fragmentation. Cached blocks
+ * are reported apart from live ones. */
+mem_heap_info_t mem_get_heap_info(void) {
+    mem_heap_info_t info = {0};
+    add_heap_info(&main_heap, &info);
+    for (int node = 0; node < MAX_NUMA_NODES; node++) {
+        add_heap_info(&node_heaps[node], &info);
+    }
+    
+    for (int cls = 0; cls < MEM_FAST_CLASSES; cls++) {
+        info.cached_bytes += mem_fast_cache.count[cls] * fast_block_size(cls);
+        info.live_blocks -= mem_fast_cache.count[cls];
+        info.header_bytes -= mem_fast_cache.count[cls] * sizeof(block_header_t);
+    }
+    
+    call_counters_t calls = {0};
+    default_calls(&calls);
+    finish_heap_info(&info, &calls);
+    return info;
+}
+
+/* Whether an allocated main-heap block is sitting in the fast-path cache */
+static int fast_cache_holds(block_header_t* block) {
+    size_t usable = block->size - sizeof(block_header_t);
+    if (usable > MEM_FAST_MAX) {
+        return 0;
+    }
+    void* user = (char*)block + sizeof(block_header_t);
+    for (void* p = mem_fast_cache.head[usable / 16 - 1]; p; p = *(void**)p) {
+        if (p == user) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int walk_block(mem_walk_fn callback, void* ctx, block_header_t* block, int state, int origin) {
+    mem_block_info_t info = { block, block->size, state, origin };
+    return callback(&info, ctx);
+}
+
+/* Walk one heap: its range, then its extent regions and huge blocks.
+ * Reads block headers only, so it neither allocates nor changes state. */
+static int walk_heap(heap_t* h, mem_walk_fn callback, void* ctx) {
+    int result;
+    
+    if (h->heap_start) {
+        char* end = hptr(h, h->heap_end);
+        for (char* p = hptr(h, h->heap_start); p < end; p += ((block_header_t*)p)->size) {
+            block_header_t* block = (block_header_t*)p;
+            if (block->is_mmap == BLOCK_FENCE) {
+                continue;
+            }
+            int state = block->is_free || block == hptr(h, h->top) ? MEM_BLOCK_FREE : MEM_BLOCK_USED;
+            if (state == MEM_BLOCK_USED && h == &main_heap && fast_cache_holds(block)) {
+                state = MEM_BLOCK_CACHED;
+            }
+            if ((result = walk_block(callback, ctx, block, state, MEM_BLOCK_HEAP))) {
+                return result;
+            }
+        }
+    }
+    
+    /* Extents tile each region after its header page */
+    for (extent_region_t* region = h->regions; region; region = region->next) {
+        char* end = (char*)region + EXTENT_REGION_SIZE;
+        for (char* p = (char*)region + page_size(); p < end; p += ((block_header_t*)p)->size) {
+            block_header_t* block = (block_header_t*)p;
+            int state = block->is_free ? MEM_BLOCK_FREE : MEM_BLOCK_USED;
+            if ((result = walk_block(callback, ctx, block, state, MEM_BLOCK_EXTENT))) {
+                return result;
+            }
+        }
+    }
+    
+    for (block_header_t* block = hptr(h, h->huge_blocks); block; block = hptr(h, block->next)) {
+        if ((result = walk_block(callback, ctx, block, MEM_BLOCK_USED, MEM_BLOCK_MMAP))) {
+            return result;
+        }
+    }
+    return 0;
+}
+
+/* Walk the default heaps */
+int mem_heap_walk(mem_walk_fn callback, void* ctx) {
+    int result = walk_heap(&main_heap, callback, ctx);
+    for (int node = 0; node < MAX_NUMA_NODES && !result; node++) {
+        result = walk_heap(&node_heaps[node], callback, ctx);
+    }
+    return result;
+}
+
+/* Get per-size-class statistics (summed over the default heaps) */
+int mem_get_class_stats(mem_class_stats_t* stats, int max_classes) {
+    call_counters_t calls = {0};
+    default_calls(&calls);
+    return export_class_stats(calls.classes, stats, max_classes);
+}
+
+/* Print statistics */
+void mem_print_stats(void) {
+    mem_stats_t stats = mem_get_stats();
+    
+    printf("Memory Allocator Statistics:\n");
+    printf("  Total allocated: %zu bytes\n", stats.total_allocated);
+    printf("  Total freed: %zu bytes\n", stats.total_freed);
+    printf("  Current usage: %zu bytes\n", stats.current_usage);
+    printf("  Number of allocations: %zu\n", stats.num_allocations);
+    printf("  Number of frees: %zu\n", stats.num_frees);
+    printf("  Number of splits: %zu\n", stats.num_splits);
+    printf("  Number of coalesces: %zu\n", stats.num_coalesces);
+    printf("  Number of heap expansions: %zu\n", stats.num_expansions);
+    printf("  Time spent growing heap: %zu ns\n", stats.growth_ns);
+    printf("  Live mappings: %zu\n", stats.num_mappings);
+    printf("  Fast-path cache hits: %zu\n", stats.num_fast_hits);
+    
+    mem_class_stats_t classes[NUM_SIZE_CLASSES];
+    mem_get_class_stats(classes, NUM_SIZE_CLASSES);
+    printf("  Size classes (block size, header included):\n");
+    printf("    %10s %10s %10s %10s %12s %8s\n",
+           "up to", "allocs", "frees", "live", "live bytes", "used");
+    for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+        const mem_class_stats_t* c = &classes[i];
+        if (c->num_allocations == 0) {
+            continue;
+        }
+        char limit[24];
+        if (c->max_block_size == SIZE_MAX) {
+            snprintf(limit, sizeof(limit), "larger");
+        } else {
+            snprintf(limit, sizeof(limit), "%zu", c->max_block_size);
+        }
+        /* Share of granted bytes the callers asked for */
+        printf("    %10s %10zu %10zu %10zu %12zu %7.1f%%\n",
+               limit, c->num_allocations, c->num_frees, c->live_blocks, c->live_bytes,
+               100.0 * (double)c->requested_bytes / (double)c->granted_bytes);
+    }
+    
+    mem_heap_info_t info = mem_get_heap_info();
+    printf("  Heap: %zu bytes, %zu free (%zu in top chunk, %zu in %zu free blocks)\n",
+           info.heap_size, info.free_bytes, info.top_bytes,
+           info.free_bytes - info.top_bytes, info.free_blocks);
+    printf("  Fast-path cache: %zu bytes\n", info.cached_bytes);
+    printf("  Largest free block: %zu bytes, fragmentation %.1f%%\n",
+           info.largest_free_block, 100.0 * info.fragmentation);
+    printf("  Overhead: %zu header bytes, %zu bytes total\n",
+           info.header_bytes, info.overhead_bytes);
+    
+    int header = 0;
+    for (int op = 0; op < MEM_LATENCY_OPS; op++) {
+        for (int path = 0; path < MEM_PATHS; path++) {
+            mem_latency_stats_t l = mem_get_latency(op, path);
+            if (l.count == 0) {
+                continue;
+            }
+            if (!header) {
+                printf("  Latency of the _ts functions (ns):\n");
+                printf("    %-6s %-9s %10s %8s %8s %8s %8s %10s\n",
+                       "op", "path", "count", "mean", "p50", "p99", "p99.9", "max");
+                header = 1;
+            }
+            printf("    %-6s %-9s %10zu %8.0f %8.0f %8.0f %8.0f %10.0f\n",
+                   latency_op_names[op], latency_path_names[path], l.count, l.mean_ns,
+                   l.p50_ns, l.p99_ns, l.p999_ns, l.max_ns);
+        }
+    }
+}
+
+/* One counter or gauge: its JSON key, Prometheus name and help text */
+typedef struct {
+    const char* key;
+    const char* metric;
+    const char* type;
+    const char* help;
+    size_t value;
+    int nanoseconds;            /* Exported to Prometheus in seconds */
+} stats_field_t;
+
+#define STATS_FIELDS 11
+#define HEAP_FIELDS 9
+
+static void stats_fields(const mem_stats_t* s, stats_field_t* f) {
+    const stats_field_t fields[STATS_FIELDS] = {
+        { "total_allocated", "mem_allocated_bytes_total", "counter", "Block bytes handed out", s->total_allocated, 0 },
+        { "total_freed", "mem_freed_bytes_total", "counter", "Block bytes returned", s->total_freed, 0 },
+        { "current_usage", "mem_usage_bytes", "gauge", "Block bytes currently allocated", s->current_usage, 0 },
+        { "num_allocations", "mem_allocations_total", "counter", "Allocations", s->num_allocations, 0 },
+        { "num_frees", "mem_frees_total", "counter", "Frees", s->num_frees, 0 },
+        { "num_splits", "mem_splits_total", "counter", "Free blocks split", s->num_splits, 0 },
+        { "num_coalesces", "mem_coalesces_total", "counter", "Free blocks merged", s->num_coalesces, 0 },
+        { "num_expansions", "mem_heap_expansions_total", "counter", "Heap growth operations", s->num_expansions, 0 },
+        { "growth_ns", "mem_heap_growth_seconds_total", "counter", "Time spent growing the heap", s->growth_ns, 1 },
+        { "num_mappings", "mem_mappings", "gauge", "Live mmap regions", s->num_mappings, 0 },
+        { "num_fast_hits", "mem_fast_hits_total", "counter", "Allocations served by the fast-path cache", s->num_fast_hits, 0 },
+    };
+    memcpy(f, fields, sizeof(fields));
+}
+
+static void heap_fields(const mem_heap_info_t* i, stats_field_t* f) {
+    const stats_field_t fields[HEAP_FIELDS] = {
+        { "heap_size", "mem_heap_size_bytes", "gauge", "Bytes obtained from the system", i->heap_size, 0 },
+        { "free_bytes", "mem_heap_free_bytes", "gauge", "Free-list blocks plus the top chunk", i->free_bytes, 0 },
+        { "free_blocks", "mem_heap_free_blocks", "gauge", "Free-list blocks", i->free_blocks, 0 },
+        { "top_bytes", "mem_heap_top_bytes", "gauge", "Top chunk", i->top_bytes, 0 },
+        { "largest_free_block", "mem_heap_largest_free_block_bytes", "gauge", "Largest free block or top chunk", i->largest_free_block, 0 },
+        { "live_blocks", "mem_heap_live_blocks", "gauge", "Allocated blocks", i->live_blocks, 0 },
+        { "header_bytes", "mem_heap_header_bytes", "gauge", "Headers of allocated blocks", i->header_bytes, 0 },
+        { "overhead_bytes", "mem_heap_overhead_bytes", "gauge", "Allocated bytes not requested by callers", i->overhead_bytes, 0 },
+        { "cached_bytes", "mem_heap_cached_bytes", "gauge", "Blocks held by the fast-path cache", i->cached_bytes, 0 },
+    };
+    memcpy(f, fields, sizeof(fields));
+}
+
+/* Start a JSON member: ,"key": */
+static void json_key(output_t* out, int* first, const char* key) {
+    out_str(out, *first ? "\"" : ",\"");
+    out_str(out, key);
+    out_str(out, "\":");
+    *first = 0;
+}
+
+static void json_uint(output_t* out, int* first, const char* key, size_t value) {
+    json_key(out, first, key);
+    out_uint(out, value);
+}
+
+/* Class limit, or the given word for the last, unbounded class */
+static void out_limit(output_t* out, size_t max_block_size, const char* unbounded) {
+    if (max_block_size == SIZE_MAX) {
+        out_str(out, unbounded);
+    } else {
+        out_uint(out, max_block_size);
+    }
+}
+
+/* Everything on one line, so that repeated dumps form JSON Lines */
+static void write_json(output_t* out, const mem_stats_t* stats, const mem_class_stats_t* classes,
+                       const mem_heap_info_t* info) {
+    stats_field_t fields[STATS_FIELDS];
+    stats_fields(stats, fields);
+    int first = 1;
+    out_str(out, "{");
+    for (int i = 0; i < STATS_FIELDS; i++) {
+        json_uint(out, &first, fields[i].key, fields[i].value);
+    }
+    
+    json_key(out, &first, "size_classes");
+    for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+        const mem_class_stats_t* c = &classes[i];
+        int member = 1;
+        out_str(out, i ? ",{" : "[{");
+        json_key(out, &member, "max_block_size");
+        out_limit(out, c->max_block_size, "null");
+        json_uint(out, &member, "num_allocations", c->num_allocations);
+        json_uint(out, &member, "num_frees", c->num_frees);
+        json_uint(out, &member, "live_blocks", c->live_blocks);
+        json_uint(out, &member, "live_bytes", c->live_bytes);
+        json_uint(out, &member, "requested_bytes", c->requested_bytes);
+        json_uint(out, &member, "granted_bytes", c->granted_bytes);
+        out_str(out, "}");
+    }
+    out_str(out, "]");
+    
+    if (info) {
+        stats_field_t heap[HEAP_FIELDS];
+        heap_fields(info, heap);
+        int member = 1;
+        json_key(out, &first, "heap");
+        out_str(out, "{");
+        for (int i = 0; i < HEAP_FIELDS; i++) {
+            json_uint(out, &member, heap[i].key, heap[i].value);
+        }
+        json_key(out, &member, "fragmentation");
+        out_fixed(out, info->fragmentation, 6);
+        json_key(out, &member, "bins");
+        for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+            int bin = 1;
+            out_str(out, i ? ",{" : "[{");
+            json_key(out, &bin, "max_block_size");
+            out_limit(out, classes[i].max_block_size, "null");
+            json_uint(out, &bin, "free_bytes", info->bin_free_bytes[i]);
+            json_uint(out, &bin, "free_blocks", info->bin_free_blocks[i]);
+            out_str(out, "}");
+        }
+        out_str(out, "]}");
+    }
+    
+    json_key(out, &first, "latency");
+    for (int op = 0; op < MEM_LATENCY_OPS; op++) {
+        out_str(out, op ? ",\"" : "{\"");
+        out_str(out, latency_op_names[op]);
+        out_str(out, "\":");
+        for (int path = 0; path < MEM_PATHS; path++) {
+            mem_latency_stats_t l = mem_get_latency(op, path);
+            const double values[] = { l.mean_ns, l.p50_ns, l.p90_ns, l.p99_ns, l.p999_ns, l.max_ns };
+            static const char* const keys[] = { "mean_ns", "p50_ns", "p90_ns", "p99_ns", "p999_ns", "max_ns" };
+            int member = 1;
+            out_str(out, path ? ",\"" : "{\"");
+            out_str(out, latency_path_names[path]);
+            out_str(out, "\":{");
+            json_uint(out, &member, "count", l.count);
+            for (int k = 0; k < 6; k++) {
+                json_key(out, &member, keys[k]);
+                out_fixed(out, values[k], 1);
+            }
+            out_str(out, "}");
+        }
+        out_str(out, "}");
+    }
+    out_str(out, "}}\n");
+}
+
+static void prom_header(output_t* out, const char* metric, const char* type, const char* help) {
+    out_str(out, "# HELP ");
+    out_str(out, metric);
+    out_str(out, " ");
+    out_str(out, help);
+    out_str(out, "\n# TYPE ");
+    out_str(out, metric);
+    out_str(out, " ");
+    out_str(out, type);
+    out_str(out, "\n");
+}
+
+static void prom_field(output_t* out, const stats_field_t* f) {
+    prom_header(out, f->metric, f->type, f->help);
+    out_str(out, f->metric);
+    out_str(out, " ");
+    if (f->nanoseconds) {
+        out_fixed(out, (double)f->value / 1e9, 9);
+    } else {
+        out_uint(out, f->value);
+    }
+    out_str(out, "\n");
+}
+
+/* One metric per class or bin, labelled with the block size limit */
+static void prom_by_class(output_t* out, const char* metric, const char* type, const char* help,
+                          const mem_class_stats_t* classes, const size_t* values, size_t stride) {
+    prom_header(out, metric, type, help);
+    for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+        out_str(out, metric);
+        out_str(out, "{max_block_size=\"");
+        out_limit(out, classes[i].max_block_size, "+Inf");
+        out_str(out, "\"} ");
+        out_uint(out, *(const size_t*)((const char*)values + i * stride));
+        out_str(out, "\n");
+    }
+}
+
+static void prom_latency_labels(output_t* out, const char* metric, int op, int path) {
+    out_str(out, metric);
+    out_str(out, "{op=\"");
+    out_str(out, latency_op_names[op]);
+    out_str(out, "\",path=\"");
+    out_str(out, latency_path_names[path]);
+    out_str(out, "\"");
+}
+
+/* Prometheus text exposition format, version 0.0.4 */
+static void write_prometheus(output_t* out, const mem_stats_t* stats, const mem_class_stats_t* classes,
+                             const mem_heap_info_t* info) {
+    stats_field_t fields[STATS_FIELDS];
+    stats_fields(stats, fields);
+    for (int i = 0; i < STATS_FIELDS; i++) {
+        prom_field(out, &fields[i]);
+    }
+    
+    const size_t stride = sizeof(mem_class_stats_t);
+    prom_by_class(out, "mem_class_allocations_total", "counter", "Allocations by size class",
+                  classes, &classes[0].num_allocations, stride);
+    prom_by_class(out, "mem_class_frees_total", "counter", "Frees by size class",
+                  classes, &classes[0].num_frees, stride);
+    prom_by_class(out, "mem_class_live_blocks", "gauge", "Allocated blocks by size class",
+                  classes, &classes[0].live_blocks, stride);
+    prom_by_class(out, "mem_class_live_bytes", "gauge", "Allocated block bytes by size class",
+                  classes, &classes[0].live_bytes, stride);
+    prom_by_class(out, "mem_class_requested_bytes_total", "counter", "Bytes asked for by size class",
+                  classes, &classes[0].requested_bytes, stride);
+    prom_by_class(out, "mem_class_granted_bytes_total", "counter", "Block bytes handed out by size class",
+                  classes, &classes[0].granted_bytes, stride);
+    
+    if (info) {
+        stats_field_t heap[HEAP_FIELDS];
+        heap_fields(info, heap);
+        for (int i = 0; i < HEAP_FIELDS; i++) {
+            prom_field(out, &heap[i]);
+        }
+        prom_header(out, "mem_heap_fragmentation_ratio", "gauge",
+                    "1 - largest free block / free bytes");
+        out_str(out, "mem_heap_fragmentation_ratio ");
+        out_fixed(out, info->fragmentation, 6);
+        out_str(out, "\n");
+        prom_by_class(out, "mem_heap_bin_free_bytes", "gauge", "Free-list bytes by bin",
+                      classes, info->bin_free_bytes, sizeof(size_t));
+        prom_by_class(out, "mem_heap_bin_free_blocks", "gauge", "Free-list blocks by bin",
+                      classes, info->bin_free_blocks, sizeof(size_t));
+    }
+    
+    static const char* const quantiles[] = { "0.5", "0.9", "0.99", "0.999" };
+    prom_header(out, "mem_latency_seconds", "summary", "Latency of the _ts functions");
+    for (int op = 0; op < MEM_LATENCY_OPS; op++) {
+        for (int path = 0; path < MEM_PATHS; path++) {
+            mem_latency_stats_t l = mem_get_latency(op, path);
+            const double values[] = { l.p50_ns, l.p90_ns, l.p99_ns, l.p999_ns };
+            for (int q = 0; q < 4; q++) {
+                prom_latency_labels(out, "mem_latency_seconds", op, path);
+                out_str(out, ",quantile=\"");
+                out_str(out, quantiles[q]);
+                out_str(out, "\"} ");
+                out_fixed(out, values[q] / 1e9, 9);
+                out_str(out, "\n");
+            }
+            prom_latency_labels(out, "mem_latency_seconds_sum", op, path);
+            out_str(out, "} ");
+            out_fixed(out, l.mean_ns * (double)l.count / 1e9, 9);
+            out_str(out, "\n");
+            prom_latency_labels(out, "mem_latency_seconds_count", op, path);
+            out_str(out, "} ");
+            out_uint(out, l.count);
+            out_str(out, "\n");
+        }
+    }
+}
+
+/* Write the statistics; heap info is left out when with_heap is 0 */
+static int stats_write(int fd, int format, int with_heap) {
+    if (format != MEM_STATS_JSON && format != MEM_STATS_PROMETHEUS) {
+        errno = EINVAL;
+        return -1;
+    }
+    
+    output_t out = { .fd = fd };
+    mem_stats_t stats = mem_get_stats();
+    mem_class_stats_t classes[NUM_SIZE_CLASSES];
+    mem_get_class_stats(classes, NUM_SIZE_CLASSES);
+    mem_heap_info_t info = {0};
+    if (with_heap) {
+        info = mem_get_heap_info();
+    }
+    
+    if (format == MEM_STATS_JSON) {
+        write_json(&out, &stats, classes, with_heap ? &info : NULL);
+    } else {
+        write_prometheus(&out, &stats, classes, with_heap ? &info : NULL);
+    }
+    out_flush(&out);
+    if (out.error) {
+        errno = out.error;
+        return -1;
+    }
+    return 0;
+}
+
+/* Write statistics, per-class data and heap info to a file descriptor */
+int mem_stats_write(int fd, int format) {
+    return stats_write(fd, format, 1);
+}
+
+static volatile sig_atomic_t stats_signal_fd = -1;
+static volatile sig_atomic_t stats_signal_format;
+
+/* Walking the heap could meet a half-updated free list, so the signal
+ * dump has the lock-free counters only */
+static void stats_signal_handler(int signo) {
+    (void)signo;
+    int saved_errno = errno;
+    stats_write(stats_signal_fd, stats_signal_format, 0);
+    errno = saved_errno;
+}
+
+/* Dump statistics to fd whenever signo arrives */
+int mem_stats_signal(int signo, int fd, int format) {
+    if (format != MEM_STATS_JSON && format != MEM_STATS_PROMETHEUS) {
+        errno = EINVAL;
+        return -1;
+    }
+    stats_signal_fd = fd;
+    stats_signal_format = format;
+    
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stats_signal_handler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    return sigaction(signo, &action, NULL);
+}
+
+/* Reset a heap's statistics (the live mapping count is state, not a counter) */
+static void reset_stats(heap_t* h) {
+    size_t num_mappings = h->stats.num_mappings;
+    memset(&h->stats, 0, sizeof(h->stats));
+    memset(&h->calls, 0, sizeof(h->calls));
+    h->stats.num_mappings = num_mappings;
+}
+
+/* Reset allocator state (for testing) */
+void mem_reset(void) {
+    /* Reset statistics and rebuild free lists from the heap contents */
+    fast_cache_flush();
+    memset(mem_fast_cache.hits, 0, sizeof(mem_fast_cache.hits));
+    memset(mem_fast_cache.requested, 0, sizeof(mem_fast_cache.requested));
+    memset(mem_fast_cache.frees, 0, sizeof(mem_fast_cache.frees));
+    for (int i = 0; i < MAX_STAT_SHARDS; i++) {
+        memset(&stat_shards[i].calls, 0, sizeof(stat_shards[i].calls));
+    }
+    memset(&overflow_shard.calls, 0, sizeof(overflow_shard.calls));
+    memset(latency_hists, 0, sizeof(latency_hists));
+    reset_stats(&main_heap);
+    rebuild_free_lists(&main_heap);
+    for (int node = 0; node < MAX_NUMA_NODES; node++) {
+        reset_stats(&node_heaps[node]);
+        rebuild_free_lists(&node_heaps[node]);
     }
     
-    /* Note: We don't reset heap_start/heap_end as brk() is global */
+    /* Note: We don't reset heap ranges as brk() is global */
 }
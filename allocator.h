@@ -3,6 +3,10 @@
 
 #include <stddef.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
  * Custom Memory Allocator API
  * 
@@ -10,6 +14,7 @@
  * - mmap/brk for memory acquisition
  * - Segregated free lists for efficient allocation
  * - Block splitting and coalescing to minimize fragmentation
+ * - Per-NUMA-node heaps on multi-socket machines
  */
 
 /* Thread-unsafe versions (faster) */
@@ -18,12 +23,143 @@ void mem_free(void* ptr);
 void* mem_calloc(size_t nmemb, size_t size);
 void* mem_realloc(void* ptr, size_t size);
 
+/* Inline fast path: mem_malloc() of a compile-time constant size up to
+ * MEM_FAST_MAX bytes resolves its cache class at compile time and pops a
+ * block of exactly that class from the cache mem_free() fills, without
+ * calling into the library. Other sizes, and an empty cache, take the
+ * normal call. Define MEM_NO_INLINE before including this header to
+ * disable it. */
+#define MEM_FAST_MAX 256             /* Largest size served by the fast path */
+#define MEM_FAST_CLASSES (MEM_FAST_MAX / 16)
+#define MEM_FAST_LIMIT 32            /* Blocks cached per class */
+
+/* Exact-size block cache (internal; read by the inline fast path) */
+typedef struct {
+    void* head[MEM_FAST_CLASSES];   /* Cached blocks, linked through user memory */
+    unsigned int count[MEM_FAST_CLASSES];
+    size_t hits[MEM_FAST_CLASSES];  /* Allocations served from the cache */
+    size_t requested[MEM_FAST_CLASSES];  /* Bytes asked for by those allocations */
+    size_t frees[MEM_FAST_CLASSES]; /* Frees that went into the cache */
+    size_t sample_countdown;        /* Bytes to allocate before the next profile sample */
+} mem_fast_cache_t;
+
+extern mem_fast_cache_t mem_fast_cache;
+
+/* Allocation entry points (internal): kept in one ELF section so that the
+ * heap profiler can drop their frames from the stacks it records */
+#if defined(__GNUC__) && defined(__ELF__)
+#define MEM_ENTRY __attribute__((section("mem_entry")))
+#else
+#define MEM_ENTRY
+#endif
+
+#if defined(__GNUC__) && !defined(MEM_NO_INLINE)
+static inline __attribute__((always_inline)) void* mem_fast_malloc(size_t size) {
+    size_t cls = (size - 1) / 16;   /* Folded to a constant */
+    void* ptr = mem_fast_cache.head[cls];
+    if (__builtin_expect(ptr != NULL && size < mem_fast_cache.sample_countdown, 1)) {
+        mem_fast_cache.sample_countdown -= size;
+        mem_fast_cache.head[cls] = *(void**)ptr;
+        mem_fast_cache.count[cls]--;
+#ifndef MEM_DISABLE_STATS
+        mem_fast_cache.hits[cls]++;
+        mem_fast_cache.requested[cls] += size;
+#endif
+        return ptr;
+    }
+    return (mem_malloc)(size);
+}
+
+#define mem_malloc(size) \
+    (__builtin_constant_p(size) && (size_t)(size) - 1 < MEM_FAST_MAX \
+         ? mem_fast_malloc(size) : (mem_malloc)(size))
+#endif
+
 /* Thread-safe versions (with mutex protection) */
 void* mem_malloc_ts(size_t size);
 void mem_free_ts(void* ptr);
 void* mem_calloc_ts(size_t nmemb, size_t size);
 void* mem_realloc_ts(void* ptr, size_t size);
 
+/* Aligned allocation (alignment must be a power of two; free with mem_free)
+ * and the usable size of any allocation */
+void* mem_memalign(size_t alignment, size_t size);
+void* mem_memalign_ts(size_t alignment, size_t size);
+size_t mem_usable_size(void* ptr);
+
+/* NUMA-aware allocation (free with mem_free/mem_free_ts) */
+void* mem_malloc_onnode(size_t size, int node);
+void* mem_malloc_onnode_ts(size_t size, int node);
+int mem_numa_nodes(void);
+
+/* Heap pre-reservation flags for mem_reserve() */
+#define MEM_RESERVE_PREFAULT 0x1    /* Fault pages in now instead of on first use */
+#define MEM_RESERVE_LOCK     0x2    /* Lock reserved pages in RAM with mlock() */
+
+/* Heap pre-reservation (returns 0 on success, -1 on failure) */
+int mem_reserve(size_t bytes, int flags);
+int mem_reserve_ts(size_t bytes, int flags);
+
+/* Sampled heap profiling. About once every sample_bytes allocated from
+ * the default heaps (0 means 512KB), the allocating call stack is
+ * recorded until the block is freed. Profiles are written in the pprof
+ * heap format (pprof --text ./program heap.prof). These functions may be
+ * called from any thread; they return 0, or -1 with errno set. */
+int mem_profile_start(size_t sample_bytes);
+void mem_profile_stop(void);
+int mem_profile_dump(const char* path);
+int mem_profile_dump_at_exit(const char* path);
+
+/* Release unused memory at the top of the heap (returns bytes released) */
+size_t mem_trim(size_t pad);
+size_t mem_trim_ts(size_t pad);
+
+/* Arenas: bump-pointer regions freed all at once (not thread-safe) */
+typedef struct mem_arena mem_arena_t;
+
+mem_arena_t* mem_arena_create(size_t chunk_size);
+void* mem_arena_alloc(mem_arena_t* arena, size_t size);
+void* mem_arena_alloc_aligned(mem_arena_t* arena, size_t size, size_t alignment);
+void mem_arena_reset(mem_arena_t* arena);
+void mem_arena_destroy(mem_arena_t* arena);
+
+/* Arena position for LIFO release */
+typedef struct {
+    void* chunk;
+    void* ptr;
+} mem_arena_mark_t;
+
+mem_arena_mark_t mem_arena_mark(mem_arena_t* arena);
+void mem_arena_release(mem_arena_t* arena, mem_arena_mark_t mark);
+
+/* Frame allocator: per-thread scratch stack with mark/release */
+typedef mem_arena_mark_t mem_frame_mark_t;
+
+mem_frame_mark_t mem_frame_mark(void);
+void* mem_frame_alloc(size_t size);
+void mem_frame_release(mem_frame_mark_t mark);
+
+/* Fixed-size object pools (the _ts versions lock the pool) */
+typedef struct mem_pool mem_pool_t;
+
+typedef struct {
+    size_t obj_size;            /* Object stride in bytes */
+    size_t align;               /* Object alignment */
+    size_t num_slabs;
+    size_t capacity;            /* Objects the current slabs can hold */
+    size_t in_use;
+    size_t num_allocations;
+    size_t num_frees;
+} mem_pool_stats_t;
+
+mem_pool_t* mem_pool_create(size_t obj_size, size_t align);
+void* mem_pool_alloc(mem_pool_t* pool);
+void mem_pool_free(mem_pool_t* pool, void* obj);
+void* mem_pool_alloc_ts(mem_pool_t* pool);
+void mem_pool_free_ts(mem_pool_t* pool, void* obj);
+mem_pool_stats_t mem_pool_get_stats(mem_pool_t* pool);
+void mem_pool_destroy(mem_pool_t* pool);
+
 /* Utility functions */
 void mem_print_stats(void);
 void mem_reset(void);
@@ -37,8 +173,167 @@ typedef struct {
     size_t num_frees;
     size_t num_splits;
     size_t num_coalesces;
+    size_t num_expansions;      /* Heap growth operations (sbrk/region) */
+    size_t growth_ns;           /* Time spent growing the heap */
+    size_t num_mappings;        /* Live mmap() regions */
+    size_t num_fast_hits;       /* Allocations served by the fast-path cache */
 } mem_stats_t;
 
 mem_stats_t mem_get_stats(void);
 
+/* Per-size-class statistics. Classes follow the free-list bins: by block
+ * size (header included), powers of two from 32 bytes up to 8KB, then
+ * one class for everything larger. */
+#define MEM_SIZE_CLASSES 10
+
+typedef struct {
+    size_t max_block_size;      /* Largest block size in the class (SIZE_MAX for the last) */
+    size_t num_allocations;
+    size_t num_frees;
+    size_t live_blocks;
+    size_t live_bytes;          /* Block bytes currently allocated */
+    size_t requested_bytes;     /* Bytes asked for (lifetime) */
+    size_t granted_bytes;       /* Block bytes handed out (lifetime) */
+} mem_class_stats_t;
+
+/* Fill up to max_classes entries; returns the number of classes */
+int mem_get_class_stats(mem_class_stats_t* stats, int max_classes);
+
+/* Free space and fragmentation of the heap range that small blocks are
+ * carved from (extents and huge mappings are not included). Computed by
+ * walking the free lists and the heap, so it costs O(blocks). */
+typedef struct {
+    size_t heap_size;           /* Bytes obtained from the system */
+    size_t free_bytes;          /* Free-list blocks plus the top chunk */
+    size_t free_blocks;         /* Free-list blocks */
+    size_t bin_free_bytes[MEM_SIZE_CLASSES];
+    size_t bin_free_blocks[MEM_SIZE_CLASSES];
+    size_t top_bytes;           /* Top chunk (in free_bytes, not in any bin) */
+    size_t largest_free_block;  /* Largest free block or top chunk */
+    double fragmentation;       /* 1 - largest_free_block / free_bytes (0 when all free space is one block) */
+    size_t live_blocks;         /* Allocated blocks */
+    size_t header_bytes;        /* Headers of allocated blocks */
+    size_t overhead_bytes;      /* Allocated bytes not requested by callers: headers,
+                                   alignment and unsplit remainders (estimated from
+                                   the size-class statistics) */
+    size_t cached_bytes;        /* Blocks held by the fast-path cache */
+} mem_heap_info_t;
+
+mem_heap_info_t mem_get_heap_info(void);
+
+/* Block states and origins reported by mem_heap_walk() */
+#define MEM_BLOCK_USED   0
+#define MEM_BLOCK_FREE   1          /* Free-list block, free extent or top chunk */
+#define MEM_BLOCK_CACHED 2          /* Freed into the fast-path cache */
+
+#define MEM_BLOCK_HEAP   0          /* In a heap range */
+#define MEM_BLOCK_EXTENT 1          /* Carved from an mmap'd extent region */
+#define MEM_BLOCK_MMAP   2          /* Mapped on its own */
+
+typedef struct {
+    void* address;              /* Block start (the header) */
+    size_t size;                /* Block size, header included */
+    int state;                  /* MEM_BLOCK_USED, MEM_BLOCK_FREE, MEM_BLOCK_CACHED */
+    int origin;                 /* MEM_BLOCK_HEAP, MEM_BLOCK_EXTENT, MEM_BLOCK_MMAP */
+} mem_block_info_t;
+
+/* Return nonzero to stop the walk */
+typedef int (*mem_walk_fn)(const mem_block_info_t* block, void* ctx);
+
+/* Report every block of the default heaps in address order per heap,
+ * then extents and huge mappings. Returns 0, or the callback's nonzero
+ * result. The callback must not allocate from or free to the default
+ * heaps; with the _ts version it must not call the _ts functions. */
+int mem_heap_walk(mem_walk_fn callback, void* ctx);
+int mem_heap_walk_ts(mem_walk_fn callback, void* ctx);
+
+/* Latency histograms of the _ts functions, by operation and by the path
+ * the operation took. Off until enabled; times include lock waits. */
+#define MEM_LATENCY_MALLOC 0        /* malloc, calloc, realloc, memalign */
+#define MEM_LATENCY_FREE   1
+#define MEM_LATENCY_OPS    2
+
+#define MEM_PATH_ALL       (-1)     /* Every path combined */
+#define MEM_PATH_FAST      0        /* Fast-path cache */
+#define MEM_PATH_FREE_LIST 1        /* Free lists or top chunk */
+#define MEM_PATH_GROWTH    2        /* Heap grown first (sbrk, mprotect) */
+#define MEM_PATH_MMAP      3        /* Extent region or own mapping */
+#define MEM_PATHS          4
+
+typedef struct {
+    size_t count;
+    double mean_ns;
+    double p50_ns;
+    double p90_ns;
+    double p99_ns;
+    double p999_ns;
+    double max_ns;
+} mem_latency_stats_t;
+
+void mem_latency_enable(int enable);
+mem_latency_stats_t mem_get_latency(int op, int path);
+double mem_latency_percentile(int op, int path, double percentile);  /* 0 to 100 */
+
+/* Latency hooks (internal; called by the _ts functions under their lock) */
+unsigned long long mem_latency_begin(void);
+void mem_latency_end(int op, unsigned long long start);
+
+/* Fork hooks (internal; called by the atfork handlers of the _ts
+ * functions after the allocator mutex, which is taken first) */
+void mem_fork_prepare_locks(void);
+void mem_fork_parent_unlock(void);
+void mem_fork_child_reset(void);
+
+/* Statistics export: the counters, per-class statistics, heap info and
+ * latency summaries as one line of JSON or as Prometheus text. Writing
+ * needs no heap memory. Returns 0, or -1 with errno set. */
+#define MEM_STATS_JSON       0
+#define MEM_STATS_PROMETHEUS 1
+
+int mem_stats_write(int fd, int format);
+int mem_stats_write_ts(int fd, int format);
+
+/* Write the statistics to fd from a handler for signo (e.g. SIGUSR1).
+ * The handler leaves heap info out: it may run mid-allocation. */
+int mem_stats_signal(int signo, int fd, int format);
+
+/* Heap growth policy: each expansion is growth_percent of the current
+ * heap size, clamped to [min_increment, max_increment] */
+typedef struct {
+    size_t min_increment;
+    size_t max_increment;
+    unsigned int growth_percent;
+} mem_growth_policy_t;
+
+void mem_set_growth_policy(const mem_growth_policy_t* policy);
+mem_growth_policy_t mem_get_growth_policy(void);
+
+/* Heap instances: isolated heaps with their own free lists and statistics.
+ * Memory must be freed with the heap it came from. Only shared heaps are
+ * locked (across processes); other instances are not thread-safe. */
+typedef struct heap mem_heap_t;
+
+mem_heap_t* mem_heap_create(void);
+mem_heap_t* mem_heap_create_in(void* buffer, size_t size);
+mem_heap_t* mem_heap_create_shared(int fd, size_t size);
+mem_heap_t* mem_heap_attach_shared(int fd);
+mem_heap_t* mem_heap_open_file(const char* path, size_t size);
+void mem_heap_set_root(mem_heap_t* heap, void* ptr);
+void* mem_heap_get_root(mem_heap_t* heap);
+size_t mem_heap_offset(mem_heap_t* heap, const void* ptr);
+void* mem_heap_pointer(mem_heap_t* heap, size_t offset);
+void mem_heap_destroy(mem_heap_t* heap);
+void* mem_heap_malloc(mem_heap_t* heap, size_t size);
+void mem_heap_free(mem_heap_t* heap, void* ptr);
+void* mem_heap_calloc(mem_heap_t* heap, size_t nmemb, size_t size);
+void* mem_heap_realloc(mem_heap_t* heap, void* ptr, size_t size);
+void* mem_heap_memalign(mem_heap_t* heap, size_t alignment, size_t size);
+mem_stats_t mem_heap_get_stats(mem_heap_t* heap);
+int mem_heap_get_class_stats(mem_heap_t* heap, mem_class_stats_t* stats, int max_classes);
+mem_heap_info_t mem_heap_get_info(mem_heap_t* heap);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* ALLOCATOR_H */
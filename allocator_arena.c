@@ -0,0 +1,188 @@
+#define _GNU_SOURCE
+#include "allocator.h"
+#include <pthread.h>
+#include <stdint.h>
+
+/* Arena configuration */
+#define ARENA_ALIGNMENT 16
+#define ARENA_CHUNK_SIZE (64 * 1024)   /* Default chunk size */
+
+/* Arena chunk: header followed by bump-allocated memory */
+typedef struct arena_chunk {
+    struct arena_chunk* next;       /* Next chunk (reused after a reset) */
+    size_t size;                    /* Usable bytes after the header */
+} arena_chunk_t;
+
+/* Arena state */
+struct mem_arena {
+    char* ptr;                      /* Next free byte in the current chunk */
+    char* end;                      /* End of the current chunk */
+    arena_chunk_t* current;         /* Chunk being bump-allocated */
+    arena_chunk_t* first;           /* First chunk, where a reset restarts */
+    size_t chunk_size;              /* Usable size of regular chunks */
+};
+
+/* Make a chunk the current bump region */
+static void arena_use_chunk(mem_arena_t* arena, arena_chunk_t* chunk) {
+    arena->current = chunk;
+    arena->ptr = (char*)(chunk + 1);
+    arena->end = arena->ptr + chunk->size;
+}
+
+/* Bump-allocate from the current chunk, or NULL if it does not fit */
+static void* arena_bump(mem_arena_t* arena, size_t size, size_t alignment) {
+    uintptr_t p = ((uintptr_t)arena->ptr + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    
+    if (arena->current == NULL || p < (uintptr_t)arena->ptr ||
+        size > (uintptr_t)arena->end - p) {
+        return NULL;
+    }
+    arena->ptr = (char*)(p + size);
+    return (void*)p;
+}
+
+/* Create an arena; chunk_size 0 selects the default */
+mem_arena_t* mem_arena_create(size_t chunk_size) {
+    mem_arena_t* arena = (mem_arena_t*)mem_malloc_ts(sizeof(mem_arena_t));
+    if (!arena) {
+        return NULL;
+    }
+    
+    arena->ptr = NULL;
+    arena->end = NULL;
+    arena->current = NULL;
+    arena->first = NULL;
+    arena->chunk_size = chunk_size ? chunk_size : ARENA_CHUNK_SIZE;
+    
+    return arena;
+}
+
+/* Allocate size bytes aligned to alignment (a power of two) */
+void* mem_arena_alloc_aligned(mem_arena_t* arena, size_t size, size_t alignment) {
+    if (!arena || size == 0 || alignment == 0 || (alignment & (alignment - 1))) {
+        return NULL;
+    }
+    if (alignment < ARENA_ALIGNMENT) {
+        alignment = ARENA_ALIGNMENT;
+    }
+    
+    void* ptr = arena_bump(arena, size, alignment);
+    if (ptr) {
+        return ptr;
+    }
+    
+    /* Reuse the next chunk left over from before a reset if it fits */
+    arena_chunk_t* next = arena->current ? arena->current->next : arena->first;
+    if (next && next->size >= size + alignment) {
+        arena_use_chunk(arena, next);
+        return arena_bump(arena, size, alignment);
+    }
+    
+    /* Otherwise insert a new chunk after the current one */
+    size_t usable = arena->chunk_size;
+    if (usable < size + alignment) {
+        usable = size + alignment;
+    }
+    arena_chunk_t* chunk = (arena_chunk_t*)mem_malloc_ts(sizeof(arena_chunk_t) + usable);
+    if (!chunk) {
+        return NULL;
+    }
+    chunk->size = usable;
+    chunk->next = next;
+    if (arena->current) {
+        arena->current->next = chunk;
+    } else {
+        arena->first = chunk;
+    }
+    
+    arena_use_chunk(arena, chunk);
+    return arena_bump(arena, size, alignment);
+}
+
+/* Allocate size bytes with the default alignment */
+void* mem_arena_alloc(mem_arena_t* arena, size_t size) {
+    return mem_arena_alloc_aligned(arena, size, ARENA_ALIGNMENT);
+}
+
+/* Free everything allocated from the arena, keeping its chunks for reuse */
+void mem_arena_reset(mem_arena_t* arena) {
+    if (!arena || !arena->first) {
+        return;
+    }
+    arena_use_chunk(arena, arena->first);
+}
+
+/* Record the arena's current position */
+mem_arena_mark_t mem_arena_mark(mem_arena_t* arena) {
+    mem_arena_mark_t mark = { arena->current, arena->ptr };
+    return mark;
+}
+
+/* Free everything allocated since mark was taken (LIFO) */
+void mem_arena_release(mem_arena_t* arena, mem_arena_mark_t mark) {
+    arena->current = (arena_chunk_t*)mark.chunk;
+    arena->ptr = (char*)mark.ptr;
+    arena->end = arena->current ? (char*)(arena->current + 1) + arena->current->size : NULL;
+}
+
+/* Destroy an arena and release its chunks */
+void mem_arena_destroy(mem_arena_t* arena) {
+    if (!arena) {
+        return;
+    }
+    
+    arena_chunk_t* chunk = arena->first;
+    while (chunk) {
+        arena_chunk_t* next = chunk->next;
+        mem_free_ts(chunk);
+        chunk = next;
+    }
+    mem_free_ts(arena);
+}
+
+/* Per-thread frame stack: a thread-local arena, destroyed at thread exit */
+static __thread mem_arena_t* frame_arena = NULL;
+static pthread_key_t frame_key;
+static pthread_once_t frame_key_once = PTHREAD_ONCE_INIT;
+
+static void frame_arena_destroy(void* arena) {
+    mem_arena_destroy((mem_arena_t*)arena);
+}
+
+static void frame_key_create(void) {
+    pthread_key_create(&frame_key, frame_arena_destroy);
+}
+
+/* Get the calling thread's frame arena, creating it on first use */
+static mem_arena_t* frame_stack(void) {
+    if (!frame_arena) {
+        pthread_once(&frame_key_once, frame_key_create);
+        frame_arena = mem_arena_create(0);
+        if (frame_arena) {
+            pthread_setspecific(frame_key, frame_arena);
+        }
+    }
+    return frame_arena;
+}
+
+/* Mark the top of the calling thread's frame stack */
+mem_frame_mark_t mem_frame_mark(void) {
+    mem_frame_mark_t mark = { NULL, NULL };
+    if (frame_arena) {
+        mark = mem_arena_mark(frame_arena);
+    }
+    return mark;
+}
+
+/* Allocate scratch memory on the calling thread's frame stack */
+void* mem_frame_alloc(size_t size) {
+    mem_arena_t* arena = frame_stack();
+    return arena ? mem_arena_alloc(arena, size) : NULL;
+}
+
+/* Pop the frame stack back to mark */
+void mem_frame_release(mem_frame_mark_t mark) {
+    if (frame_arena) {
+        mem_arena_release(frame_arena, mark);
+    }
+}
@@ -0,0 +1,521 @@
+#ifndef ALLOCATOR_HEAP_HPP
+#define ALLOCATOR_HEAP_HPP
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "allocator.h"
+
+/**
+ * Header-only, policy-based version of the allocator (C++17).
+ *
+ *   mem::basic_heap<SizeClassPolicy, LockPolicy, BackendPolicy, StatsPolicy>
+ *
+ * The algorithm is the one in allocator.c: segregated free lists, block
+ * splitting, forward coalescing, a top chunk grown by a growth policy,
+ * and large blocks mapped directly. The policies pick, at compile time:
+ *
+ *   SizeClassPolicy  pow2_size_classes<N, Min>  (constexpr class table)
+ *   LockPolicy       no_lock | mutex_lock
+ *   BackendPolicy    sbrk_backend | mmap_backend | fixed_backend
+ *   StatsPolicy      basic_stats | no_stats
+ *
+ * Empty policies (no_lock, no_stats) take no space and their calls
+ * compile to nothing, so hot paths inline fully. mem::heap, the default
+ * instantiation, behaves like the C library's mem_malloc/mem_free.
+ */
+
+namespace mem {
+
+/* ---- Size class policies ---- */
+
+/* NumClasses power-of-two classes starting at MinSize; the last class
+ * takes everything larger. The defaults are the C library's classes. */
+template <std::size_t NumClasses = 10, std::size_t MinSize = 32>
+struct pow2_size_classes {
+    static_assert(NumClasses >= 2, "need at least two size classes");
+    static_assert((MinSize & (MinSize - 1)) == 0, "MinSize must be a power of two");
+
+    static constexpr std::size_t num_classes = NumClasses;
+
+    /* Upper bound of each class but the last */
+    static constexpr std::array<std::size_t, NumClasses - 1> limits = [] {
+        std::array<std::size_t, NumClasses - 1> table{};
+        std::size_t limit = MinSize;
+        for (std::size_t i = 0; i < table.size(); i++) {
+            table[i] = limit;
+            limit *= 2;
+        }
+        return table;
+    }();
+
+    static constexpr std::size_t index(std::size_t size) noexcept {
+        for (std::size_t i = 0; i < limits.size(); i++) {
+            if (size <= limits[i]) {
+                return i;
+            }
+        }
+        return NumClasses - 1;
+    }
+};
+
+/* ---- Lock policies ---- */
+
+struct no_lock {
+    void lock() noexcept {}
+    void unlock() noexcept {}
+};
+
+class mutex_lock {
+public:
+    void lock() { mutex_.lock(); }
+    void unlock() { mutex_.unlock(); }
+
+private:
+    std::mutex mutex_;
+};
+
+/* ---- Statistics policies ---- */
+
+struct no_stats {
+    void on_alloc(std::size_t) noexcept {}
+    void on_free(std::size_t) noexcept {}
+    void on_split() noexcept {}
+    void on_coalesce() noexcept {}
+    void on_expand() noexcept {}
+    mem_stats_t get() const noexcept { return mem_stats_t{}; }
+};
+
+class basic_stats {
+public:
+    void on_alloc(std::size_t size) noexcept {
+        stats_.total_allocated += size;
+        stats_.current_usage += size;
+        stats_.num_allocations++;
+    }
+    void on_free(std::size_t size) noexcept {
+        stats_.total_freed += size;
+        stats_.current_usage -= size;
+        stats_.num_frees++;
+    }
+    void on_split() noexcept { stats_.num_splits++; }
+    void on_coalesce() noexcept { stats_.num_coalesces++; }
+    void on_expand() noexcept { stats_.num_expansions++; }
+    mem_stats_t get() const noexcept { return stats_; }
+
+private:
+    mem_stats_t stats_{};
+};
+
+/* ---- Backend policies ----
+ *
+ * grow(need, want, got) returns at least need new bytes (want if it
+ * can), setting got to the amount, or nullptr. Memory that does not
+ * start where the previous grow ended is handled by the heap.
+ * Requests of direct_threshold bytes or more go to map()/unmap(). */
+
+namespace detail {
+
+inline void* map_pages(std::size_t size) noexcept {
+    void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return ptr == MAP_FAILED ? nullptr : ptr;
+}
+
+inline std::size_t page_round(std::size_t size) noexcept {
+    std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    return (size + page - 1) & ~(page - 1);
+}
+
+}  // namespace detail
+
+/* The program break, as used by the C library's default heap */
+struct sbrk_backend {
+    static constexpr std::size_t direct_threshold = 128 * 1024;
+
+    void* grow(std::size_t, std::size_t want, std::size_t& got) noexcept {
+        void* old_brk = sbrk(static_cast<intptr_t>(want));
+        if (old_brk == reinterpret_cast<void*>(-1)) {
+            return nullptr;
+        }
+        got = want;
+        return old_brk;
+    }
+
+    void* map(std::size_t size) noexcept { return detail::map_pages(size); }
+    void unmap(void* ptr, std::size_t size) noexcept { munmap(ptr, size); }
+};
+
+/* A private reserved range, committed as it grows (always contiguous) */
+class mmap_backend {
+public:
+    static constexpr std::size_t direct_threshold = 128 * 1024;
+
+    explicit mmap_backend(std::size_t reserve = std::size_t(1) << (sizeof(void*) == 8 ? 36 : 28)) noexcept
+        : reserve_(reserve) {}
+
+    mmap_backend(const mmap_backend&) = delete;
+    mmap_backend& operator=(const mmap_backend&) = delete;
+
+    ~mmap_backend() {
+        if (base_) {
+            munmap(base_, reserve_);
+        }
+    }
+
+    void* grow(std::size_t, std::size_t want, std::size_t& got) noexcept {
+        if (!base_) {
+            void* base = mmap(nullptr, reserve_, PROT_NONE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (base == MAP_FAILED) {
+                return nullptr;
+            }
+            base_ = static_cast<char*>(base);
+        }
+        want = detail::page_round(want);
+        if (reserve_ - used_ < want ||
+            mprotect(base_ + used_, want, PROT_READ | PROT_WRITE) != 0) {
+            return nullptr;
+        }
+        char* start = base_ + used_;
+        used_ += want;
+        got = want;
+        return start;
+    }
+
+    void* map(std::size_t size) noexcept { return detail::map_pages(size); }
+    void unmap(void* ptr, std::size_t size) noexcept { munmap(ptr, size); }
+
+private:
+    char* base_ = nullptr;
+    std::size_t reserve_;
+    std::size_t used_ = 0;
+};
+
+/* A caller-provided buffer: handed out whole, never grown, no syscalls */
+class fixed_backend {
+public:
+    static constexpr std::size_t direct_threshold = SIZE_MAX;
+
+    fixed_backend(void* buffer, std::size_t size) noexcept
+        : buffer_(static_cast<char*>(buffer)), size_(size) {}
+
+    void* grow(std::size_t need, std::size_t, std::size_t& got) noexcept {
+        if (given_ || size_ < need) {
+            return nullptr;
+        }
+        given_ = true;
+        got = size_;
+        return buffer_;
+    }
+
+    void* map(std::size_t) noexcept { return nullptr; }
+    void unmap(void*, std::size_t) noexcept {}
+
+private:
+    char* buffer_;
+    std::size_t size_;
+    bool given_ = false;
+};
+
+/* ---- The heap ---- */
+
+template <class SizeClassPolicy = pow2_size_classes<>,
+          class LockPolicy = no_lock,
+          class BackendPolicy = sbrk_backend,
+          class StatsPolicy = basic_stats>
+class basic_heap : private LockPolicy, private StatsPolicy {
+public:
+    static constexpr std::size_t alignment = 16;
+    static constexpr std::size_t min_block_size = 32;
+
+    template <class... BackendArgs>
+    explicit basic_heap(BackendArgs&&... args) : backend_(static_cast<BackendArgs&&>(args)...) {}
+
+    basic_heap(const basic_heap&) = delete;
+    basic_heap& operator=(const basic_heap&) = delete;
+
+    void* malloc(std::size_t size) {
+        if (size == 0) {
+            return nullptr;
+        }
+        std::lock_guard<LockPolicy> guard(*this);
+        return allocate(size);
+    }
+
+    void free(void* ptr) {
+        if (!ptr) {
+            return;
+        }
+        std::lock_guard<LockPolicy> guard(*this);
+        deallocate(ptr);
+    }
+
+    void* calloc(std::size_t nmemb, std::size_t size) {
+        if (nmemb == 0 || size == 0 || size > SIZE_MAX / nmemb) {
+            return nullptr;
+        }
+        void* ptr = malloc(nmemb * size);
+        if (ptr) {
+            std::memset(ptr, 0, nmemb * size);
+        }
+        return ptr;
+    }
+
+    void* realloc(void* ptr, std::size_t size) {
+        if (!ptr) {
+            return malloc(size);
+        }
+        if (size == 0) {
+            free(ptr);
+            return nullptr;
+        }
+        std::size_t old_size = header(ptr)->size - sizeof(block);
+        if (old_size >= size) {
+            return ptr;
+        }
+        void* new_ptr = malloc(size);
+        if (new_ptr) {
+            std::memcpy(new_ptr, ptr, old_size);
+            free(ptr);
+        }
+        return new_ptr;
+    }
+
+    mem_stats_t stats() const noexcept { return StatsPolicy::get(); }
+
+    BackendPolicy& backend() noexcept { return backend_; }
+
+private:
+    /* Same layout as the C library's block header */
+    struct block {
+        std::size_t size;           /* Including this header */
+        block* next;                /* Free list links */
+        block* prev;
+        int is_free;
+        int origin;                 /* heap, direct or fence */
+    };
+    static_assert(sizeof(block) % alignment == 0, "block header must keep alignment");
+
+    enum : int { origin_heap = 0, origin_direct = 1, origin_fence = 2 };
+
+    static constexpr std::size_t num_classes = SizeClassPolicy::num_classes;
+    static constexpr std::size_t min_growth = 64 * 1024;
+    static constexpr std::size_t max_growth = 16 * 1024 * 1024;
+
+    static constexpr std::size_t align_up(std::size_t size) noexcept {
+        return (size + alignment - 1) & ~(alignment - 1);
+    }
+
+    static block* header(void* ptr) noexcept {
+        return reinterpret_cast<block*>(static_cast<char*>(ptr) - sizeof(block));
+    }
+
+    static void* payload(block* b) noexcept {
+        return reinterpret_cast<char*>(b) + sizeof(block);
+    }
+
+    static block* at(char* p) noexcept { return reinterpret_cast<block*>(p); }
+
+    static char* end_of(block* b) noexcept { return reinterpret_cast<char*>(b) + b->size; }
+
+    void* allocate(std::size_t size) {
+        std::size_t total = align_up(size + sizeof(block));
+        if (total < size) {
+            return nullptr;  /* Overflow */
+        }
+        block* b;
+
+        if (total >= BackendPolicy::direct_threshold) {
+            b = static_cast<block*>(backend_.map(total));
+            if (!b) {
+                return nullptr;
+            }
+            b->size = total;
+            b->origin = origin_direct;
+        } else if ((b = find_fit(total)) != nullptr) {
+            unlink(b);
+            split(b, total);
+        } else if ((b = carve_top(total)) == nullptr) {
+            return nullptr;
+        }
+
+        b->is_free = 0;
+        StatsPolicy::on_alloc(b->size);
+        return payload(b);
+    }
+
+    void deallocate(void* ptr) {
+        block* b = header(ptr);
+        StatsPolicy::on_free(b->size);
+
+        if (b->origin == origin_direct) {
+            backend_.unmap(b, b->size);
+            return;
+        }
+
+        b->is_free = 1;
+        b = coalesce(b);
+        if (b != top_) {
+            push(b);
+        }
+    }
+
+    /* First fit, starting at the request's size class */
+    block* find_fit(std::size_t total) noexcept {
+        for (std::size_t i = SizeClassPolicy::index(total); i < num_classes; i++) {
+            for (block* b = free_lists_[i]; b; b = b->next) {
+                if (b->size >= total) {
+                    return b;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    void push(block* b) noexcept {
+        std::size_t i = SizeClassPolicy::index(b->size);
+        b->is_free = 1;
+        b->prev = nullptr;
+        b->next = free_lists_[i];
+        if (b->next) {
+            b->next->prev = b;
+        }
+        free_lists_[i] = b;
+    }
+
+    void unlink(block* b) noexcept {
+        if (b->prev) {
+            b->prev->next = b->next;
+        } else {
+            free_lists_[SizeClassPolicy::index(b->size)] = b->next;
+        }
+        if (b->next) {
+            b->next->prev = b->prev;
+        }
+        b->next = b->prev = nullptr;
+    }
+
+    void split(block* b, std::size_t total) noexcept {
+        if (b->size >= total + sizeof(block) + min_block_size) {
+            block* rest = at(reinterpret_cast<char*>(b) + total);
+            rest->size = b->size - total;
+            rest->origin = origin_heap;
+            b->size = total;
+            push(rest);
+            StatsPolicy::on_split();
+        }
+    }
+
+    /* Merge forward with free neighbours and the top chunk */
+    block* coalesce(block* b) noexcept {
+        for (;;) {
+            char* next_addr = end_of(b);
+            if (next_addr + sizeof(block) > end_) {
+                return b;
+            }
+            block* next = at(next_addr);
+            if (next == top_) {
+                b->size += next->size;
+                top_ = b;
+                StatsPolicy::on_coalesce();
+                return b;
+            }
+            if (!next->is_free || next->origin != origin_heap) {
+                return b;
+            }
+            unlink(next);
+            b->size += next->size;
+            StatsPolicy::on_coalesce();
+        }
+    }
+
+    /* Carve from the top chunk, growing the heap if it is too small.
+     * The top always keeps min_block_size bytes. */
+    block* carve_top(std::size_t total) {
+        if (!top_ || top_->size < total + min_block_size) {
+            if (!expand(total + min_block_size + alignment) || top_->size < total + min_block_size) {
+                return nullptr;
+            }
+        }
+        block* b = top_;
+        top_ = at(reinterpret_cast<char*>(b) + total);
+        top_->size = b->size - total;
+        top_->is_free = 1;
+        top_->origin = origin_heap;
+        top_->next = top_->prev = nullptr;
+        b->size = total;
+        return b;
+    }
+
+    /* Grow by the growth policy (100% of the heap, 64KB..16MB) */
+    bool expand(std::size_t need) {
+        std::size_t want = heap_size_;
+        want = want < min_growth ? min_growth : want > max_growth ? max_growth : want;
+        want = want < need ? need : want;
+
+        std::size_t got = 0;
+        char* raw = static_cast<char*>(backend_.grow(need + alignment, want + alignment, got));
+        if (!raw) {
+            return false;
+        }
+        char* start = reinterpret_cast<char*>(align_up(reinterpret_cast<uintptr_t>(raw)));
+        char* new_end = reinterpret_cast<char*>(
+            reinterpret_cast<uintptr_t>(raw + got) & ~static_cast<uintptr_t>(alignment - 1));
+        heap_size_ += got;
+        StatsPolicy::on_expand();
+
+        if (top_ && start == end_) {
+            top_->size += static_cast<std::size_t>(new_end - end_);
+        } else {
+            if (top_) {
+                seal(start);
+            }
+            top_ = at(start);
+            top_->size = static_cast<std::size_t>(new_end - start);
+            top_->is_free = 1;
+            top_->origin = origin_heap;
+            top_->next = top_->prev = nullptr;
+        }
+        end_ = new_end;
+        return true;
+    }
+
+    /* New memory is not contiguous: the old top becomes a free block,
+     * followed by a fence over the gap so nothing coalesces across it */
+    void seal(char* next_segment) noexcept {
+        block* fence = top_;
+        if (top_->size >= sizeof(block) + min_block_size) {
+            top_->size -= sizeof(block);
+            fence = at(end_of(top_));
+            push(top_);
+        }
+        fence->size = static_cast<std::size_t>(next_segment - reinterpret_cast<char*>(fence));
+        fence->is_free = 0;
+        fence->origin = origin_fence;
+        top_ = nullptr;
+    }
+
+    BackendPolicy backend_;
+    block* free_lists_[num_classes] = {};
+    block* top_ = nullptr;
+    char* end_ = nullptr;
+    std::size_t heap_size_ = 0;
+};
+
+/* Same behavior as mem_malloc/mem_free */
+using heap = basic_heap<>;
+
+/* Thread-safe, in a private reserved range */
+using locked_heap = basic_heap<pow2_size_classes<>, mutex_lock, mmap_backend, basic_stats>;
+
+/* For pinned or static memory: no syscalls, no locks, no counters */
+using fixed_heap = basic_heap<pow2_size_classes<>, no_lock, fixed_backend, no_stats>;
+
+}  // namespace mem
+
+#endif /* ALLOCATOR_HEAP_HPP */
@@ -0,0 +1,152 @@
+#include <cstddef>
+#include <new>
+#include "allocator.h"
+
+/**
+ * Global operator new/delete replacement. Link this object into a C++
+ * program (together with liballocator.a) and every new/delete expression
+ * is served by the thread-safe allocator:
+ *
+ *   g++ -o app app.o allocator_new.o -L. -lallocator -pthread
+ *
+ * Sized deletes ignore the size: freeing reads the block header anyway
+ * (its size covers any unsplit remainder, and coalescing needs it), so
+ * the caller's size would not save any memory access.
+ */
+
+namespace {
+
+/* Allocate or run the new-handler until it gives up */
+MEM_ENTRY void* allocate(std::size_t size) {
+    if (size == 0) {
+        size = 1;
+    }
+    for (;;) {
+        void* ptr = mem_malloc_ts(size);
+        if (ptr) {
+            return ptr;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+MEM_ENTRY void* allocate_aligned(std::size_t size, std::align_val_t alignment) {
+    if (size == 0) {
+        size = 1;
+    }
+    for (;;) {
+        void* ptr = mem_memalign_ts(static_cast<std::size_t>(alignment), size);
+        if (ptr) {
+            return ptr;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+MEM_ENTRY void* allocate_nothrow(std::size_t size) noexcept {
+    try {
+        return allocate(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+MEM_ENTRY void* allocate_aligned_nothrow(std::size_t size, std::align_val_t alignment) noexcept {
+    try {
+        return allocate_aligned(size, alignment);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+}  // namespace
+
+/* Plain */
+MEM_ENTRY void* operator new(std::size_t size) {
+    return allocate(size);
+}
+
+MEM_ENTRY void* operator new[](std::size_t size) {
+    return allocate(size);
+}
+
+MEM_ENTRY void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return allocate_nothrow(size);
+}
+
+MEM_ENTRY void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return allocate_nothrow(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    mem_free_ts(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    mem_free_ts(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    mem_free_ts(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+    mem_free_ts(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    mem_free_ts(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+    mem_free_ts(ptr);
+}
+
+/* Over-aligned (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__) */
+MEM_ENTRY void* operator new(std::size_t size, std::align_val_t alignment) {
+    return allocate_aligned(size, alignment);
+}
+
+MEM_ENTRY void* operator new[](std::size_t size, std::align_val_t alignment) {
+    return allocate_aligned(size, alignment);
+}
+
+MEM_ENTRY void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return allocate_aligned_nothrow(size, alignment);
+}
+
+MEM_ENTRY void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return allocate_aligned_nothrow(size, alignment);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+    mem_free_ts(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+    mem_free_ts(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    mem_free_ts(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    mem_free_ts(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept {
+    mem_free_ts(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept {
+    mem_free_ts(ptr);
+}
@@ -0,0 +1,161 @@
+#ifndef ALLOCATOR_PMR_HPP
+#define ALLOCATOR_PMR_HPP
+
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+#include "allocator.h"
+
+/**
+ * std::pmr::memory_resource adapters (C++17, header-only).
+ *
+ *   mem::default_resource()  - default heap, thread-safe (mem_*_ts)
+ *   mem::heap_resource       - one mem_heap_t instance
+ *   mem::arena_resource      - bump arena; deallocate is a no-op
+ *   mem::pool_resource       - fixed-size pool, other sizes go upstream
+ *
+ * The adapters do not own the underlying heap, arena or pool. Only the
+ * default resource is thread-safe; the others are as safe as the object
+ * they wrap (a shared heap locks, everything else does not).
+ *
+ *   mem::arena_resource scratch(arena);
+ *   std::pmr::vector<int> v(&scratch);
+ */
+
+namespace mem {
+
+namespace detail {
+
+/* Memory resources must throw instead of returning nullptr */
+inline void* checked(void* ptr) {
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+}  // namespace detail
+
+/* The default heap, through the thread-safe functions */
+class default_memory_resource : public std::pmr::memory_resource {
+protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        return detail::checked(mem_memalign_ts(alignment, bytes ? bytes : 1));
+    }
+
+    void do_deallocate(void* ptr, std::size_t, std::size_t) override {
+        mem_free_ts(ptr);
+    }
+
+    /* All instances share the same heap */
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return dynamic_cast<const default_memory_resource*>(&other) != nullptr;
+    }
+};
+
+inline default_memory_resource* default_resource() noexcept {
+    static default_memory_resource resource;
+    return &resource;
+}
+
+/* A heap instance */
+class heap_resource : public std::pmr::memory_resource {
+public:
+    explicit heap_resource(mem_heap_t* heap) noexcept : heap_(heap) {}
+
+    mem_heap_t* heap() const noexcept { return heap_; }
+
+protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        return detail::checked(mem_heap_memalign(heap_, alignment, bytes ? bytes : 1));
+    }
+
+    void do_deallocate(void* ptr, std::size_t, std::size_t) override {
+        mem_heap_free(heap_, ptr);
+    }
+
+    /* Equal when they allocate from the same heap */
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        auto* o = dynamic_cast<const heap_resource*>(&other);
+        return o && o->heap_ == heap_;
+    }
+
+private:
+    mem_heap_t* heap_;
+};
+
+/* A bump arena: memory comes back with mem_arena_reset/release only */
+class arena_resource : public std::pmr::memory_resource {
+public:
+    explicit arena_resource(mem_arena_t* arena) noexcept : arena_(arena) {}
+
+    mem_arena_t* arena() const noexcept { return arena_; }
+
+protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        return detail::checked(mem_arena_alloc_aligned(arena_, bytes ? bytes : 1, alignment));
+    }
+
+    void do_deallocate(void*, std::size_t, std::size_t) override {}
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        auto* o = dynamic_cast<const arena_resource*>(&other);
+        return o && o->arena_ == arena_;
+    }
+
+private:
+    mem_arena_t* arena_;
+};
+
+/* A fixed-size pool. Requests that fit the pool's object size and
+ * alignment are pool objects; anything else is passed to upstream.
+ * pmr passes the same size and alignment to deallocate, so the same
+ * test routes each block back to where it came from. */
+class pool_resource : public std::pmr::memory_resource {
+public:
+    explicit pool_resource(mem_pool_t* pool,
+                           std::pmr::memory_resource* upstream = default_resource()) noexcept
+        : pool_(pool), upstream_(upstream) {
+        mem_pool_stats_t stats = mem_pool_get_stats(pool);
+        obj_size_ = stats.obj_size;
+        align_ = stats.align;
+    }
+
+    mem_pool_t* pool() const noexcept { return pool_; }
+    std::pmr::memory_resource* upstream_resource() const noexcept { return upstream_; }
+
+protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        if (fits(bytes, alignment)) {
+            return detail::checked(mem_pool_alloc(pool_));
+        }
+        return upstream_->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* ptr, std::size_t bytes, std::size_t alignment) override {
+        if (fits(bytes, alignment)) {
+            mem_pool_free(pool_, ptr);
+        } else {
+            upstream_->deallocate(ptr, bytes, alignment);
+        }
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        auto* o = dynamic_cast<const pool_resource*>(&other);
+        return o && o->pool_ == pool_ && o->upstream_->is_equal(*upstream_);
+    }
+
+private:
+    bool fits(std::size_t bytes, std::size_t alignment) const noexcept {
+        return bytes <= obj_size_ && alignment <= align_;
+    }
+
+    mem_pool_t* pool_;
+    std::pmr::memory_resource* upstream_;
+    std::size_t obj_size_;
+    std::size_t align_;
+};
+
+}  // namespace mem
+
+#endif /* ALLOCATOR_PMR_HPP */
@@ -0,0 +1,170 @@
+#define _GNU_SOURCE
+#include "allocator.h"
+#include <pthread.h>
+#include <stdint.h>
+
+/* Pool configuration */
+#define POOL_ALIGNMENT 16            /* Default object alignment */
+#define POOL_SLAB_SIZE (16 * 1024)   /* Target slab size */
+#define POOL_MIN_OBJECTS 8           /* Minimum objects per slab */
+
+/* Slab header, followed by the (aligned) objects */
+typedef struct pool_slab {
+    struct pool_slab* next;         /* Next slab of the pool */
+} pool_slab_t;
+
+/* Pool state */
+struct mem_pool {
+    void* free_list;                /* Intrusive LIFO of free objects */
+    char* bump;                     /* Next never-used object in the newest slab */
+    char* bump_end;                 /* End of the newest slab */
+    pool_slab_t* slabs;             /* All slabs, newest first */
+    size_t obj_size;                /* Object stride (size rounded to alignment) */
+    size_t align;                   /* Object alignment */
+    size_t objs_per_slab;
+    size_t num_slabs;
+    size_t num_allocations;
+    size_t num_frees;
+    pthread_mutex_t mutex;          /* Used by the _ts functions only */
+};
+
+/* Create a pool of obj_size objects aligned to align (0 for default) */
+mem_pool_t* mem_pool_create(size_t obj_size, size_t align) {
+    if (obj_size == 0) {
+        return NULL;
+    }
+    if (align == 0) {
+        align = POOL_ALIGNMENT;
+    }
+    if (align & (align - 1)) {
+        return NULL;
+    }
+    if (align < sizeof(void*)) {
+        align = sizeof(void*);
+    }
+    
+    mem_pool_t* pool = (mem_pool_t*)mem_malloc_ts(sizeof(mem_pool_t));
+    if (!pool) {
+        return NULL;
+    }
+    
+    /* Free objects hold the free-list link, so they need room for a pointer */
+    size_t stride = obj_size < sizeof(void*) ? sizeof(void*) : obj_size;
+    stride = (stride + align - 1) & ~(align - 1);
+    
+    pool->free_list = NULL;
+    pool->bump = NULL;
+    pool->bump_end = NULL;
+    pool->slabs = NULL;
+    pool->obj_size = stride;
+    pool->align = align;
+    pool->objs_per_slab = POOL_SLAB_SIZE / stride;
+    if (pool->objs_per_slab < POOL_MIN_OBJECTS) {
+        pool->objs_per_slab = POOL_MIN_OBJECTS;
+    }
+    pool->num_slabs = 0;
+    pool->num_allocations = 0;
+    pool->num_frees = 0;
+    pthread_mutex_init(&pool->mutex, NULL);
+    
+    return pool;
+}
+
+/* Allocate a new slab and make it the bump region */
+static int pool_add_slab(mem_pool_t* pool) {
+    size_t bytes = sizeof(pool_slab_t) + pool->align + pool->objs_per_slab * pool->obj_size;
+    pool_slab_t* slab = (pool_slab_t*)mem_malloc_ts(bytes);
+    if (!slab) {
+        return -1;
+    }
+    
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->num_slabs++;
+    
+    uintptr_t first = ((uintptr_t)(slab + 1) + pool->align - 1) & ~(uintptr_t)(pool->align - 1);
+    pool->bump = (char*)first;
+    pool->bump_end = pool->bump + pool->objs_per_slab * pool->obj_size;
+    return 0;
+}
+
+/* Allocate when the free list is empty: carve from the newest slab */
+static void* pool_alloc_slow(mem_pool_t* pool) {
+    if (pool->bump == pool->bump_end && pool_add_slab(pool) != 0) {
+        return NULL;
+    }
+    
+    void* obj = pool->bump;
+    pool->bump += pool->obj_size;
+    pool->num_allocations++;
+    return obj;
+}
+
+/* Allocate one object */
+void* mem_pool_alloc(mem_pool_t* pool) {
+    void* obj = pool->free_list;
+    if (obj) {
+        pool->free_list = *(void**)obj;
+        pool->num_allocations++;
+        return obj;
+    }
+    return pool_alloc_slow(pool);
+}
+
+/* Return one object to its pool */
+void mem_pool_free(mem_pool_t* pool, void* obj) {
+    if (!obj) {
+        return;
+    }
+    *(void**)obj = pool->free_list;
+    pool->free_list = obj;
+    pool->num_frees++;
+}
+
+/* Thread-safe pool allocation */
+void* mem_pool_alloc_ts(mem_pool_t* pool) {
+    pthread_mutex_lock(&pool->mutex);
+    void* obj = mem_pool_alloc(pool);
+    pthread_mutex_unlock(&pool->mutex);
+    return obj;
+}
+
+/* Thread-safe pool free */
+void mem_pool_free_ts(mem_pool_t* pool, void* obj) {
+    pthread_mutex_lock(&pool->mutex);
+    mem_pool_free(pool, obj);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/* Get pool statistics */
+mem_pool_stats_t mem_pool_get_stats(mem_pool_t* pool) {
+    mem_pool_stats_t stats;
+    
+    pthread_mutex_lock(&pool->mutex);
+    stats.obj_size = pool->obj_size;
+    stats.align = pool->align;
+    stats.num_slabs = pool->num_slabs;
+    stats.capacity = pool->num_slabs * pool->objs_per_slab;
+    stats.in_use = pool->num_allocations - pool->num_frees;
+    stats.num_allocations = pool->num_allocations;
+    stats.num_frees = pool->num_frees;
+    pthread_mutex_unlock(&pool->mutex);
+    
+    return stats;
+}
+
+/* Destroy a pool, releasing all of its slabs (and objects) */
+void mem_pool_destroy(mem_pool_t* pool) {
+    if (!pool) {
+        return;
+    }
+    
+    pool_slab_t* slab = pool->slabs;
+    while (slab) {
+        pool_slab_t* next = slab->next;
+        mem_free_ts(slab);
+        slab = next;
+    }
+    pthread_mutex_destroy(&pool->mutex);
+    mem_free_ts(pool);
+}
@@ -0,0 +1,123 @@
+#ifndef ALLOCATOR_POOL_HPP
+#define ALLOCATOR_POOL_HPP
+
+#include <memory>
+#include <new>
+#include <utility>
+#include "allocator.h"
+
+/**
+ * Typed object pools (C++17, header-only).
+ *
+ *   mem::object_pool<T>        - pool of T on top of mem_pool_t
+ *   mem::object_pool<T, true>  - same, locked (mem_pool_*_ts)
+ *   mem::make_pooled<T>(args)  - T from the calling thread's pool
+ *
+ * Objects come back as mem::object_pool<T>::pointer, a std::unique_ptr
+ * whose deleter runs ~T() and returns the memory to the pool it came
+ * from:
+ *
+ *   auto node = mem::make_pooled<tree_node>(key, value);
+ *
+ * The deleter keeps only the underlying mem_pool_t, so a pointer may
+ * outlive the object_pool that made it: a pool that still has live
+ * objects when destroyed is left allocated instead of being released.
+ * Objects from an unlocked pool, including the thread-local one, must be
+ * destroyed on the thread that made them; share a locked pool when
+ * objects cross threads.
+ */
+
+namespace mem {
+
+template <class T, bool ThreadSafe = false>
+class object_pool {
+public:
+    /* Returns an object to its pool */
+    class deleter {
+    public:
+        deleter() noexcept : pool_(nullptr) {}
+        explicit deleter(mem_pool_t* pool) noexcept : pool_(pool) {}
+
+        void operator()(T* obj) const noexcept {
+            obj->~T();
+            release(pool_, obj);
+        }
+
+    private:
+        mem_pool_t* pool_;
+    };
+
+    using pointer = std::unique_ptr<T, deleter>;
+
+    object_pool() : pool_(mem_pool_create(sizeof(T), alignof(T))) {
+        if (!pool_) {
+            throw std::bad_alloc();
+        }
+    }
+
+    ~object_pool() {
+        if (mem_pool_get_stats(pool_).in_use == 0) {
+            mem_pool_destroy(pool_);
+        }
+    }
+
+    object_pool(const object_pool&) = delete;
+    object_pool& operator=(const object_pool&) = delete;
+
+    /* Construct in pool memory; throws bad_alloc, or what T's constructor throws */
+    template <class... Args>
+    T* construct(Args&&... args) {
+        void* mem = ThreadSafe ? mem_pool_alloc_ts(pool_) : mem_pool_alloc(pool_);
+        if (!mem) {
+            throw std::bad_alloc();
+        }
+        try {
+            return ::new (mem) T(std::forward<Args>(args)...);
+        } catch (...) {
+            release(pool_, mem);
+            throw;
+        }
+    }
+
+    void destroy(T* obj) noexcept {
+        if (obj) {
+            deleter d(pool_);
+            d(obj);
+        }
+    }
+
+    template <class... Args>
+    pointer make(Args&&... args) {
+        return pointer(construct(std::forward<Args>(args)...), deleter(pool_));
+    }
+
+    mem_pool_stats_t stats() const noexcept { return mem_pool_get_stats(pool_); }
+    mem_pool_t* pool() const noexcept { return pool_; }
+
+    /* The calling thread's pool for T */
+    static object_pool& local() {
+        static thread_local object_pool instance;
+        return instance;
+    }
+
+private:
+    static void release(mem_pool_t* pool, void* mem) noexcept {
+        if (ThreadSafe) {
+            mem_pool_free_ts(pool, mem);
+        } else {
+            mem_pool_free(pool, mem);
+        }
+    }
+
+    mem_pool_t* pool_;
+};
+
+/* Make a T in the calling thread's pool */
+template <class T, class... Args>
+typename object_pool<T>::pointer make_pooled(Args&&... args) {
+    return object_pool<T>::local().make(std::forward<Args>(args)...);
+}
+
+}  // namespace mem
+
+#endif /* ALLOCATOR_POOL_HPP */
@@ -5,33 +5,119 @@
 /* Global mutex for thread-safe operations */
 static pthread_mutex_t allocator_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/* Hold the mutex across fork() so the child never inherits it locked
+ * mid-operation; the child gets a fresh mutex. The allocator's inner
+ * locks are taken after it, in the order used at run time. */
+static void fork_prepare(void) {
+    pthread_mutex_lock(&allocator_mutex);
+    mem_fork_prepare_locks();
+}
+
+static void fork_parent(void) {
+    mem_fork_parent_unlock();
+    pthread_mutex_unlock(&allocator_mutex);
+}
+
+static void fork_child(void) {
+    mem_fork_child_reset();
+    pthread_mutex_init(&allocator_mutex, NULL);
+}
+
+__attribute__((constructor))
+static void register_fork_handlers(void) {
+    pthread_atfork(fork_prepare, fork_parent, fork_child);
+}
+
 /* Thread-safe malloc */
-void* mem_malloc_ts(size_t size) {
+MEM_ENTRY void* mem_malloc_ts(size_t size) {
+    unsigned long long start = mem_latency_begin();
     pthread_mutex_lock(&allocator_mutex);
     void* ptr = mem_malloc(size);
+    mem_latency_end(MEM_LATENCY_MALLOC, start);
     pthread_mutex_unlock(&allocator_mutex);
     return ptr;
 }
 
 /* Thread-safe free */
 void mem_free_ts(void* ptr) {
+    if (!ptr) {
+        return;
+    }
+    unsigned long long start = mem_latency_begin();
     pthread_mutex_lock(&allocator_mutex);
     mem_free(ptr);
+    mem_latency_end(MEM_LATENCY_FREE, start);
     pthread_mutex_unlock(&allocator_mutex);
 }
 
 /* Thread-safe calloc */
-void* mem_calloc_ts(size_t nmemb, size_t size) {
+MEM_ENTRY void* mem_calloc_ts(size_t nmemb, size_t size) {
+    unsigned long long start = mem_latency_begin();
     pthread_mutex_lock(&allocator_mutex);
     void* ptr = mem_calloc(nmemb, size);
+    mem_latency_end(MEM_LATENCY_MALLOC, start);
     pthread_mutex_unlock(&allocator_mutex);
     return ptr;
 }
 
 /* Thread-safe realloc */
-void* mem_realloc_ts(void* ptr, size_t size) {
+MEM_ENTRY void* mem_realloc_ts(void* ptr, size_t size) {
+    unsigned long long start = mem_latency_begin();
     pthread_mutex_lock(&allocator_mutex);
     void* new_ptr = mem_realloc(ptr, size);
+    mem_latency_end(MEM_LATENCY_MALLOC, start);
     pthread_mutex_unlock(&allocator_mutex);
     return new_ptr;
 }
+
+/* Thread-safe aligned allocation */
+MEM_ENTRY void* mem_memalign_ts(size_t alignment, size_t size) {
+    unsigned long long start = mem_latency_begin();
+    pthread_mutex_lock(&allocator_mutex);
+    void* ptr = mem_memalign(alignment, size);
+    mem_latency_end(MEM_LATENCY_MALLOC, start);
+    pthread_mutex_unlock(&allocator_mutex);
+    return ptr;
+}
+
+/* Thread-safe node-targeted malloc */
+MEM_ENTRY void* mem_malloc_onnode_ts(size_t size, int node) {
+    unsigned long long start = mem_latency_begin();
+    pthread_mutex_lock(&allocator_mutex);
+    void* ptr = mem_malloc_onnode(size, node);
+    mem_latency_end(MEM_LATENCY_MALLOC, start);
+    pthread_mutex_unlock(&allocator_mutex);
+    return ptr;
+}
+
+/* Thread-safe heap pre-reservation */
+int mem_reserve_ts(size_t bytes, int flags) {
+    pthread_mutex_lock(&allocator_mutex);
+    int result = mem_reserve(bytes, flags);
+    pthread_mutex_unlock(&allocator_mutex);
+    return result;
+}
+
+/* Thread-safe heap walk: the heaps cannot change during the walk */
+int mem_heap_walk_ts(mem_walk_fn callback, void* ctx) {
+    pthread_mutex_lock(&allocator_mutex);
+    int result = mem_heap_walk(callback, ctx);
+    pthread_mutex_unlock(&allocator_mutex);
+    return result;
+}
+
+/* Thread-safe statistics export: the heap info is consistent */
+int mem_stats_write_ts(int fd, int format) {
+    pthread_mutex_lock(&allocator_mutex);
+    int result = mem_stats_write(fd, format);
+    pthread_mutex_unlock(&allocator_mutex);
+    return result;
+}
+
+/* Thread-safe heap trimming */
+size_t mem_trim_ts(size_t pad) {
+    pthread_mutex_lock(&allocator_mutex);
+    size_t released = mem_trim(pad);
+    pthread_mutex_unlock(&allocator_mutex);
+    return released;
+}
@@ -102,6 +102,181 @@ double benchmark_realloc(void) {
     return ((double)(end - start)) / CLOCKS_PER_SEC;
 }
 
+/* Benchmark request-scoped allocation: per-object free vs arena reset */
+#define REQUEST_OBJECTS 200
+
+double benchmark_request_malloc(void) {
+    clock_t start = clock();
+    void* ptrs[REQUEST_OBJECTS];
+    
+    for (int r = 0; r < NUM_ITERATIONS / 100; r++) {
+        for (int i = 0; i < REQUEST_OBJECTS; i++) {
+            ptrs[i] = mem_malloc((i * 37) % 256 + 16);
+        }
+        for (int i = 0; i < REQUEST_OBJECTS; i++) {
+            mem_free(ptrs[i]);
+        }
+    }
+    
+    clock_t end = clock();
+    return ((double)(end - start)) / CLOCKS_PER_SEC;
+}
+
+double benchmark_request_arena(void) {
+    clock_t start = clock();
+    mem_arena_t* arena = mem_arena_create(0);
+    
+    for (int r = 0; r < NUM_ITERATIONS / 100; r++) {
+        for (int i = 0; i < REQUEST_OBJECTS; i++) {
+            mem_arena_alloc(arena, (i * 37) % 256 + 16);
+        }
+        mem_arena_reset(arena);
+    }
+    
+    mem_arena_destroy(arena);
+    clock_t end = clock();
+    return ((double)(end - start)) / CLOCKS_PER_SEC;
+}
+
+/* Benchmark fixed-size objects: mem_malloc vs pool */
+#define POOL_OBJECT_SIZE 64
+
+double benchmark_fixed_malloc(void) {
+    clock_t start = clock();
+    void* ptrs[1000] = {NULL};
+    
+    for (int i = 0; i < NUM_ITERATIONS * 10; i++) {
+        int idx = (int)(((unsigned)i * 7919u) % 1000u);
+        if (ptrs[idx]) {
+            mem_free(ptrs[idx]);
+        }
+        ptrs[idx] = mem_malloc(POOL_OBJECT_SIZE);
+    }
+    for (int i = 0; i < 1000; i++) {
+        mem_free(ptrs[i]);
+    }
+    
+    clock_t end = clock();
+    return ((double)(end - start)) / CLOCKS_PER_SEC;
+}
+
+double benchmark_fixed_pool(void) {
+    clock_t start = clock();
+    mem_pool_t* pool = mem_pool_create(POOL_OBJECT_SIZE, 0);
+    void* ptrs[1000] = {NULL};
+    
+    for (int i = 0; i < NUM_ITERATIONS * 10; i++) {
+        int idx = (int)(((unsigned)i * 7919u) % 1000u);
+        if (ptrs[idx]) {
+            mem_pool_free(pool, ptrs[idx]);
+        }
+        ptrs[idx] = mem_pool_alloc(pool);
+    }
+    
+    mem_pool_destroy(pool);
+    clock_t end = clock();
+    return ((double)(end - start)) / CLOCKS_PER_SEC;
+}
+
+/* Benchmark constant-size allocation: inline fast path vs library call */
+struct bench_node {
+    struct bench_node* next;
+    long payload[5];
+};
+
+#define FAST_BATCH 16
+
+double benchmark_constant_inline(void) {
+    clock_t start = clock();
+    struct bench_node* nodes[FAST_BATCH];
+    
+    for (int i = 0; i < NUM_ITERATIONS * 10; i++) {
+        for (int j = 0; j < FAST_BATCH; j++) {
+            nodes[j] = mem_malloc(sizeof(struct bench_node));
+        }
+        for (int j = 0; j < FAST_BATCH; j++) {
+            mem_free(nodes[j]);
+        }
+    }
+    
+    clock_t end = clock();
+    return ((double)(end - start)) / CLOCKS_PER_SEC;
+}
+
+double benchmark_constant_call(void) {
+    clock_t start = clock();
+    struct bench_node* nodes[FAST_BATCH];
+    
+    for (int i = 0; i < NUM_ITERATIONS * 10; i++) {
+        for (int j = 0; j < FAST_BATCH; j++) {
+            nodes[j] = (mem_malloc)(sizeof(struct bench_node));  /* Bypass the macro */
+        }
+        for (int j = 0; j < FAST_BATCH; j++) {
+            mem_free(nodes[j]);
+        }
+    }
+    
+    clock_t end = clock();
+    return ((double)(end - start)) / CLOCKS_PER_SEC;
+}
+
+/* Benchmark the thread-safe functions (for latency instrumentation cost) */
+double benchmark_ts_pairs(void) {
+    clock_t start = clock();
+    void* ptrs[FAST_BATCH];
+    
+    for (int i = 0; i < NUM_ITERATIONS * 5; i++) {
+        for (int j = 0; j < FAST_BATCH; j++) {
+            ptrs[j] = mem_malloc_ts(32 + j * 64);
+        }
+        for (int j = 0; j < FAST_BATCH; j++) {
+            mem_free_ts(ptrs[j]);
+        }
+    }
+    
+    clock_t end = clock();
+    return ((double)(end - start)) / CLOCKS_PER_SEC;
+}
+
+/* Benchmark nested temporaries: malloc/free pairs vs frame allocator */
+static void nested_malloc(int depth) {
+    void* a = mem_malloc(64 + depth * 8);
+    void* b = mem_malloc(256);
+    if (depth < 8) {
+        nested_malloc(depth + 1);
+    }
+    mem_free(b);
+    mem_free(a);
+}
+
+static void nested_frame(int depth) {
+    mem_frame_mark_t mark = mem_frame_mark();
+    mem_frame_alloc(64 + depth * 8);
+    mem_frame_alloc(256);
+    if (depth < 8) {
+        nested_frame(depth + 1);
+    }
+    mem_frame_release(mark);
+}
+
+double benchmark_nested_malloc(void) {
+    clock_t start = clock();
+    for (int i = 0; i < NUM_ITERATIONS; i++) {
+        nested_malloc(0);
+    }
+    clock_t end = clock();
+    return ((double)(end - start)) / CLOCKS_PER_SEC;
+}
+
+double benchmark_nested_frame(void) {
+    clock_t start = clock();
+    for (int i = 0; i < NUM_ITERATIONS; i++) {
+        nested_frame(0);
+    }
+    clock_t end = clock();
+    return ((double)(end - start)) / CLOCKS_PER_SEC;
+}
+
 /* Test fragmentation */
 void test_fragmentation(void) {
     printf("\n=== Fragmentation Test ===\n");
@@ -235,5 +410,60 @@ int main(void) {
     double realloc_time = benchmark_realloc();
     printf("Realloc benchmark: %.3f seconds\n", realloc_time);
     
+    /* Request-scoped allocation benchmark */
+    printf("\n");
+    mem_reset();
+    double request_malloc_time = benchmark_request_malloc();
+    double request_arena_time = benchmark_request_arena();
+    printf("Request objects via malloc/free: %.3f seconds\n", request_malloc_time);
+    printf("Request objects via arena: %.3f seconds\n", request_arena_time);
+    
+    /* Fixed-size object benchmark */
+    printf("\n");
+    mem_reset();
+    double fixed_malloc_time = benchmark_fixed_malloc();
+    double fixed_pool_time = benchmark_fixed_pool();
+    printf("Fixed-size objects via malloc/free: %.3f seconds\n", fixed_malloc_time);
+    printf("Fixed-size objects via pool: %.3f seconds\n", fixed_pool_time);
+    
+    /* Constant-size allocation benchmark */
+    printf("\n");
+    mem_reset();
+    double constant_inline_time = benchmark_constant_inline();
+    double constant_call_time = benchmark_constant_call();
+    printf("Constant-size objects via inline fast path: %.3f seconds\n", constant_inline_time);
+    printf("Constant-size objects via library call: %.3f seconds\n", constant_call_time);
+    
+    /* Nested temporary allocation benchmark */
+    printf("\n");
+    mem_reset();
+    double nested_malloc_time = benchmark_nested_malloc();
+    double nested_frame_time = benchmark_nested_frame();
+    printf("Nested temporaries via malloc/free: %.3f seconds\n", nested_malloc_time);
+    printf("Nested temporaries via frames: %.3f seconds\n", nested_frame_time);
+    
+    /* Cost of sampled heap profiling at the default rate */
+    printf("\n");
+    mem_reset();
+    double unprofiled_time = benchmark_constant_call();
+    mem_profile_start(0);
+    double profiled_time = benchmark_constant_call();
+    mem_profile_stop();
+    printf("Constant-size objects, profiling off: %.3f seconds\n", unprofiled_time);
+    printf("Constant-size objects, profiling every 512KB: %.3f seconds\n", profiled_time);
+    
+    /* Cost of the latency histograms */
+    printf("\n");
+    mem_reset();
+    double untimed_time = benchmark_ts_pairs();
+    mem_latency_enable(1);
+    double timed_time = benchmark_ts_pairs();
+    mem_latency_enable(0);
+    mem_latency_stats_t latency = mem_get_latency(MEM_LATENCY_MALLOC, MEM_PATH_ALL);
+    printf("Thread-safe malloc/free, latency histograms off: %.3f seconds\n", untimed_time);
+    printf("Thread-safe malloc/free, latency histograms on: %.3f seconds\n", timed_time);
+    printf("  mem_malloc_ts p50 %.0f ns, p99 %.0f ns, p99.9 %.0f ns, max %.0f ns\n",
+           latency.p50_ns, latency.p99_ns, latency.p999_ns, latency.max_ns);
+    
     return 0;
 }
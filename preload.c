@@ -0,0 +1,126 @@
+#define _GNU_SOURCE
+#include "allocator.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/**
+ * LD_PRELOAD shim: exports the C allocation functions backed by the
+ * thread-safe allocator, so unmodified binaries can run on it:
+ *
+ *   LD_PRELOAD=./liballocator_preload.so ./program
+ *
+ * The allocator never calls malloc itself (sysfs is read with open/read,
+ * the mutex is statically initialized), so it works from the very first
+ * call during process start-up and needs no dlsym() bootstrap buffer.
+ * Nothing is forwarded to the libc allocator. Fork safety comes from the
+ * pthread_atfork handlers in allocator_ts.c.
+ *
+ * MEM_PROFILE=path turns on the sampled heap profile (MEM_PROFILE_RATE
+ * bytes between samples, default 512KB) and writes it to path at exit.
+ */
+
+#define EXPORT __attribute__((visibility("default"))) MEM_ENTRY
+
+/* malloc(0) must return a unique pointer that can be freed */
+EXPORT void* malloc(size_t size) {
+    void* ptr = mem_malloc_ts(size ? size : 1);
+    if (!ptr) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+EXPORT void free(void* ptr) {
+    mem_free_ts(ptr);
+}
+
+EXPORT void* calloc(size_t nmemb, size_t size) {
+    if (nmemb == 0 || size == 0) {
+        nmemb = size = 1;
+    }
+    void* ptr = mem_calloc_ts(nmemb, size);
+    if (!ptr) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+EXPORT void* realloc(void* ptr, size_t size) {
+    if (ptr && size == 0) {
+        mem_free_ts(ptr);
+        return NULL;
+    }
+    void* new_ptr = mem_realloc_ts(ptr, size ? size : 1);
+    if (!new_ptr) {
+        errno = ENOMEM;
+    }
+    return new_ptr;
+}
+
+EXPORT void* reallocarray(void* ptr, size_t nmemb, size_t size) {
+    if (size && nmemb > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(ptr, nmemb * size);
+}
+
+EXPORT void* memalign(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    void* ptr = mem_memalign_ts(alignment, size ? size : 1);
+    if (!ptr) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+EXPORT void* aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+EXPORT int posix_memalign(void** memptr, size_t alignment, size_t size) {
+    if (alignment == 0 || alignment % sizeof(void*) != 0 ||
+        (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void* ptr = mem_memalign_ts(alignment, size ? size : 1);
+    if (!ptr) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+EXPORT void* valloc(size_t size) {
+    return memalign((size_t)sysconf(_SC_PAGESIZE), size);
+}
+
+EXPORT void* pvalloc(size_t size) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    if (size > SIZE_MAX - page + 1) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return memalign(page, (size + page - 1) & ~(page - 1));
+}
+
+/* Reads only the block header, which the caller owns; no lock needed */
+EXPORT size_t malloc_usable_size(void* ptr) {
+    return mem_usable_size(ptr);
+}
+
+__attribute__((constructor))
+static void start_profile(void) {
+    const char* path = getenv("MEM_PROFILE");
+    if (path && *path) {
+        const char* rate = getenv("MEM_PROFILE_RATE");
+        if (mem_profile_start(rate ? strtoull(rate, NULL, 10) : 0) == 0) {
+            mem_profile_dump_at_exit(path);
+        }
+    }
+}
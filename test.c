@@ -1,6 +1,15 @@
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <pthread.h>
 #include "allocator.h"
 
 void test_basic_allocation(void) {
@@ -82,6 +91,27 @@ void test_large_allocation(void) {
     printf("  PASSED\n");
 }
 
+void test_huge_sizes(void) {
+    printf("Test: Sizes that would overflow\n");
+    
+    size_t sizes[] = { SIZE_MAX, SIZE_MAX - 8, SIZE_MAX - 64, SIZE_MAX - 4096,
+                       (size_t)PTRDIFF_MAX + 1 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        assert(mem_malloc(sizes[i]) == NULL);
+        assert(mem_malloc_ts(sizes[i]) == NULL);
+        assert(mem_calloc(1, sizes[i]) == NULL);
+        assert(mem_memalign(64, sizes[i]) == NULL);
+        assert(mem_memalign(4096, sizes[i]) == NULL);
+        
+        void* ptr = mem_malloc(100);
+        assert(ptr != NULL);
+        assert(mem_realloc(ptr, sizes[i]) == NULL);
+        mem_free(ptr);  /* Still owned after the failed realloc */
+    }
+    
+    printf("  PASSED\n");
+}
+
 void test_coalescing(void) {
     printf("Test: Block coalescing\n");
     
@@ -119,6 +149,545 @@ void test_splitting(void) {
     printf("  PASSED\n");
 }
 
+void test_memalign(void) {
+    printf("Test: Aligned allocation and usable size\n");
+    
+    size_t alignments[] = {16, 64, 4096, 65536};
+    for (int i = 0; i < 4; i++) {
+        void* small = mem_memalign(alignments[i], 100);
+        void* large = mem_memalign_ts(alignments[i], 300 * 1024);
+        assert(small != NULL && large != NULL);
+        assert(((uintptr_t)small & (alignments[i] - 1)) == 0);
+        assert(((uintptr_t)large & (alignments[i] - 1)) == 0);
+        assert(mem_usable_size(small) >= 100);
+        assert(mem_usable_size(large) >= 300 * 1024);
+        memset(small, 'A', 100);
+        memset(large, 'A', 300 * 1024);
+        
+        /* Aligned blocks resize and free like any other */
+        small = mem_realloc(small, 1000);
+        assert(small != NULL && ((char*)small)[99] == 'A');
+        mem_free(small);
+        mem_free_ts(large);
+    }
+    
+    assert(mem_memalign(48, 100) == NULL);
+    assert(mem_usable_size(NULL) == 0);
+    
+    printf("  PASSED\n");
+}
+
+struct fast_node {
+    struct fast_node* next;
+    int value;
+};
+
+void test_fast_path(void) {
+    printf("Test: Inline fast path for constant sizes\n");
+    
+    mem_reset();
+    
+    /* Freed small blocks are cached and handed back by exact size */
+    struct fast_node* a = mem_malloc(sizeof(struct fast_node));
+    struct fast_node* b = mem_malloc(sizeof(struct fast_node));
+    assert(a != NULL && b != NULL);
+    mem_free(a);
+    mem_free(b);
+    
+    struct fast_node* c = mem_malloc(sizeof(struct fast_node));
+    struct fast_node* d = mem_malloc(sizeof(struct fast_node));
+    mem_stats_t stats = mem_get_stats();
+    if (mem_numa_nodes() == 1) {
+        assert(c == b && d == a);
+        assert(stats.num_fast_hits == 2);
+    }
+    assert(stats.num_allocations == 4 && stats.num_frees == 2);
+    assert(stats.current_usage == 2 * (mem_usable_size(c) + 32));
+    c->value = d->value = 1;
+    
+    /* Runtime sizes share the cache through the library call */
+    volatile size_t runtime_size = sizeof(struct fast_node);
+    mem_free(c);
+    void* e = mem_malloc(runtime_size);
+    assert(e != NULL);
+    if (mem_numa_nodes() == 1) {
+        assert(e == c);
+    }
+    
+    /* Only exact sizes hit, never a smaller block */
+    mem_free(e);
+    void* bigger = mem_malloc(200);
+    assert(bigger != e && mem_usable_size(bigger) >= 200);
+    mem_free(bigger);
+    mem_free(d);
+    
+    stats = mem_get_stats();
+    assert(stats.num_allocations == stats.num_frees);
+    assert(stats.current_usage == 0);
+    
+    /* Trimming returns cached blocks to the heap first */
+    mem_trim(0);
+    stats = mem_get_stats();
+    assert(stats.current_usage == 0);
+    
+    printf("  PASSED\n");
+}
+
+void test_class_stats(void) {
+    printf("Test: Per-size-class statistics\n");
+    
+    mem_reset();
+    
+    mem_class_stats_t classes[MEM_SIZE_CLASSES];
+    assert(mem_get_class_stats(classes, MEM_SIZE_CLASSES) == MEM_SIZE_CLASSES);
+    assert(classes[0].max_block_size == 32 && classes[8].max_block_size == 8192);
+    assert(classes[MEM_SIZE_CLASSES - 1].max_block_size == SIZE_MAX);
+    
+    /* 100 + 32 byte header -> 144 byte blocks (class 3, up to 256);
+     * 3000 -> class 7 (up to 4096) */
+    void* small[10];
+    for (int i = 0; i < 10; i++) {
+        small[i] = mem_malloc(100);
+    }
+    void* medium = mem_malloc(3000);
+    mem_free(small[0]);
+    mem_free(small[1]);
+    
+    mem_get_class_stats(classes, MEM_SIZE_CLASSES);
+    assert(classes[3].num_allocations == 10 && classes[3].num_frees == 2);
+    assert(classes[3].live_blocks == 8 && classes[3].live_bytes == 8 * 144);
+    assert(classes[3].requested_bytes == 1000 && classes[3].granted_bytes == 10 * 144);
+    assert(classes[7].live_blocks == 1 && classes[7].requested_bytes == 3000);
+    
+    /* The classes add up to the totals */
+    mem_stats_t stats = mem_get_stats();
+    size_t allocs = 0, live = 0;
+    for (int i = 0; i < MEM_SIZE_CLASSES; i++) {
+        allocs += classes[i].num_allocations;
+        live += classes[i].live_bytes;
+    }
+    assert(allocs == stats.num_allocations && live == stats.current_usage);
+    
+    for (int i = 2; i < 10; i++) {
+        mem_free(small[i]);
+    }
+    mem_free(medium);
+    mem_get_class_stats(classes, MEM_SIZE_CLASSES);
+    assert(classes[3].live_blocks == 0 && classes[7].live_bytes == 0);
+    
+    /* Heap instances keep their own */
+    mem_heap_t* heap = mem_heap_create();
+    mem_heap_free(heap, mem_heap_malloc(heap, 5000));
+    mem_heap_get_class_stats(heap, classes, MEM_SIZE_CLASSES);
+    assert(classes[8].num_allocations == 1 && classes[8].num_frees == 1);
+    assert(classes[3].num_allocations == 0);
+    mem_heap_destroy(heap);
+    
+    printf("  PASSED\n");
+}
+
+void test_heap_info(void) {
+    printf("Test: Heap info and fragmentation\n");
+    
+    mem_reset();
+    mem_heap_info_t before = mem_get_heap_info();
+    assert(before.heap_size > 0);
+    
+    /* Free every other 1000-byte block: 1032-byte holes (class 6, up to
+     * 2048) that cannot merge */
+    void* blocks[8];
+    for (int i = 0; i < 8; i++) {
+        blocks[i] = mem_malloc(1000);
+    }
+    for (int i = 0; i < 8; i += 2) {
+        mem_free(blocks[i]);
+    }
+    
+    mem_heap_info_t info = mem_get_heap_info();
+    assert(info.bin_free_blocks[6] >= before.bin_free_blocks[6] + 4);
+    assert(info.bin_free_bytes[6] >= before.bin_free_bytes[6] + 4 * 1032);
+    assert(info.live_blocks == before.live_blocks + 4);
+    assert(info.header_bytes == info.live_blocks * 32);
+    assert(info.overhead_bytes >= 4 * 32);
+    assert(info.fragmentation > 0 && info.fragmentation < 1);
+    assert(info.largest_free_block <= info.free_bytes);
+    
+    size_t bins = 0, blocks_total = 0;
+    for (int i = 0; i < MEM_SIZE_CLASSES; i++) {
+        bins += info.bin_free_bytes[i];
+        blocks_total += info.bin_free_blocks[i];
+    }
+    assert(bins + info.top_bytes == info.free_bytes && blocks_total == info.free_blocks);
+    
+    /* Small frees sit in the fast-path cache, not in the bins */
+    void* small = mem_malloc(40);
+    mem_free(small);
+    info = mem_get_heap_info();
+    assert(info.cached_bytes == 80 || mem_numa_nodes() > 1);
+    
+    for (int i = 1; i < 8; i += 2) {
+        mem_free(blocks[i]);
+    }
+    
+    /* Heap instances. Blocks merge forward, so freeing from the top
+     * down returns everything to the top chunk. */
+    mem_heap_t* heap = mem_heap_create();
+    void* a = mem_heap_malloc(heap, 500);
+    void* b = mem_heap_malloc(heap, 500);
+    void* c = mem_heap_malloc(heap, 500);
+    mem_heap_free(heap, b);
+    info = mem_heap_get_info(heap);
+    assert(info.live_blocks == 2 && info.free_blocks == 1);
+    assert(info.fragmentation > 0);
+    mem_heap_free(heap, c);
+    mem_heap_free(heap, a);
+    info = mem_heap_get_info(heap);
+    assert(info.live_blocks == 0 && info.free_blocks == 0);
+    assert(info.free_bytes == info.top_bytes && info.fragmentation == 0);
+    mem_heap_destroy(heap);
+    
+    printf("  PASSED\n");
+}
+
+struct walk_search {
+    void* ptrs[4];
+    int state[4];
+    int origin[4];
+    size_t heap_bytes;
+    size_t blocks;
+};
+
+static int find_blocks(const mem_block_info_t* block, void* ctx) {
+    struct walk_search* search = ctx;
+    for (int i = 0; i < 4; i++) {
+        if ((char*)search->ptrs[i] - 32 == (char*)block->address) {
+            search->state[i] = block->state;
+            search->origin[i] = block->origin;
+        }
+    }
+    if (block->origin == MEM_BLOCK_HEAP) {
+        search->heap_bytes += block->size;
+    }
+    search->blocks++;
+    return 0;
+}
+
+static int stop_at_third(const mem_block_info_t* block, void* ctx) {
+    (void)block;
+    return ++*(int*)ctx == 3 ? 42 : 0;
+}
+
+void test_heap_walk(void) {
+    printf("Test: Heap walk\n");
+    
+    mem_reset();
+    
+    /* Heap block, extent, huge mapping, and a heap block freed into the
+     * fast-path cache (or the free lists on NUMA machines) */
+    struct walk_search search = {
+        .ptrs = { mem_malloc(1000), mem_malloc(200 * 1024), mem_malloc(40 * 1024 * 1024), mem_malloc(64) },
+        .state = { -1, -1, -1, -1 },
+    };
+    mem_free(search.ptrs[3]);
+    
+    assert(mem_heap_walk(find_blocks, &search) == 0);
+    assert(search.state[0] == MEM_BLOCK_USED && search.origin[0] == MEM_BLOCK_HEAP);
+    assert(search.state[1] == MEM_BLOCK_USED && search.origin[1] == MEM_BLOCK_EXTENT);
+    assert(search.state[2] == MEM_BLOCK_USED && search.origin[2] == MEM_BLOCK_MMAP);
+    assert(search.state[3] == (mem_numa_nodes() > 1 ? MEM_BLOCK_FREE : MEM_BLOCK_CACHED));
+    assert(search.origin[3] == MEM_BLOCK_HEAP);
+    
+    /* Heap blocks tile the heap ranges */
+    assert(search.heap_bytes == mem_get_heap_info().heap_size);
+    
+    /* A nonzero callback result stops the walk */
+    int seen = 0;
+    assert(mem_heap_walk(stop_at_third, &seen) == 42 && seen == 3);
+    
+    /* Freed blocks show as free; the thread-safe walk sees the same heap */
+    mem_free(search.ptrs[0]);
+    mem_free(search.ptrs[1]);
+    mem_free(search.ptrs[2]);
+    search.ptrs[2] = NULL;
+    search.heap_bytes = 0;
+    assert(mem_heap_walk_ts(find_blocks, &search) == 0);
+    assert(search.state[0] == MEM_BLOCK_FREE);
+    assert(search.state[1] == MEM_BLOCK_FREE && search.origin[1] == MEM_BLOCK_EXTENT);
+    
+    printf("  PASSED\n");
+}
+
+/* Read a dumped heap profile's totals; returns the number of stack lines */
+static int read_profile(const char* path, size_t totals[4], size_t* rate) {
+    FILE* f = fopen(path, "r");
+    assert(f != NULL);
+    char line[4096];
+    assert(fgets(line, sizeof(line), f) != NULL);
+    assert(sscanf(line, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu",
+                  &totals[0], &totals[1], &totals[2], &totals[3], rate) == 5);
+    int stacks = 0, maps = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (strstr(line, "] @ 0x")) {
+            stacks++;
+        }
+        maps |= strcmp(line, "MAPPED_LIBRARIES:\n") == 0;
+    }
+    fclose(f);
+    assert(maps);
+    return stacks;
+}
+
+void test_heap_profile(void) {
+    printf("Test: Sampled heap profile\n");
+    
+    char path[] = "/tmp/mem_profile_testXXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+    size_t totals[4], rate;
+    
+    /* Sample every allocation; a start takes effect within 1MB */
+    assert(mem_profile_start(1) == 0);
+    mem_free(mem_malloc(2 * 1024 * 1024));
+    
+    void* ptrs[10];
+    for (int i = 0; i < 10; i++) {
+        ptrs[i] = mem_malloc(1000);
+    }
+    void* inlined = mem_malloc(48);
+    void* huge = mem_malloc(40 * 1024 * 1024);
+    assert(mem_profile_dump(path) == 0);
+    assert(read_profile(path, totals, &rate) >= 1);
+    assert(totals[0] == 12 && totals[1] == 10 * 1000 + 48 + 40 * 1024 * 1024);
+    assert(totals[2] == 12 && rate == 1);
+    
+    /* Freed samples leave the live columns only */
+    for (int i = 0; i < 5; i++) {
+        mem_free(ptrs[i]);
+    }
+    mem_free(inlined);
+    mem_free(huge);
+    assert(mem_profile_dump(path) == 0);
+    read_profile(path, totals, &rate);
+    assert(totals[0] == 5 && totals[1] == 5000 && totals[2] == 12);
+    for (int i = 5; i < 10; i++) {
+        mem_free(ptrs[i]);
+    }
+    
+    /* At 64KB, 4MB of 1000-byte blocks is about 61 samples */
+    mem_profile_start(64 * 1024);
+    static void* blocks[4000];
+    for (int i = 0; i < 4000; i++) {
+        blocks[i] = mem_malloc(1000);
+    }
+    mem_profile_dump(path);
+    read_profile(path, totals, &rate);
+    assert(totals[0] >= 30 && totals[0] <= 100 && rate == 64 * 1024);
+    
+    /* Stopping keeps the live samples but takes no new ones */
+    mem_profile_stop();
+    for (int i = 0; i < 4000; i++) {
+        mem_free(blocks[i]);
+        blocks[i] = mem_malloc(1000);
+    }
+    mem_profile_dump(path);
+    size_t before = totals[2];
+    read_profile(path, totals, &rate);
+    assert(totals[0] == 0 && totals[2] == before);
+    for (int i = 0; i < 4000; i++) {
+        mem_free(blocks[i]);
+    }
+    
+    unlink(path);
+    printf("  PASSED\n");
+}
+
+void test_latency_histograms(void) {
+    printf("Test: Latency histograms\n");
+    
+    mem_reset();
+    assert(mem_get_latency(MEM_LATENCY_MALLOC, MEM_PATH_ALL).count == 0);
+    
+    /* Nothing is recorded until enabled, and only for the _ts functions */
+    mem_free_ts(mem_malloc_ts(100));
+    mem_latency_enable(1);
+    mem_free(mem_malloc(100));
+    assert(mem_get_latency(MEM_LATENCY_MALLOC, MEM_PATH_ALL).count == 0);
+    
+    /* Free-list or fast path, heap growth, and an own mapping */
+    void* ptrs[1000];
+    for (int i = 0; i < 1000; i++) {
+        ptrs[i] = mem_malloc_ts(64 + i % 7 * 100);
+    }
+    for (int i = 0; i < 1000; i++) {
+        mem_free_ts(ptrs[i]);
+    }
+    mem_trim_ts(0);
+    void* grown = mem_malloc_ts(100 * 1024);
+    void* huge = mem_malloc_ts(40 * 1024 * 1024);
+    mem_free_ts(huge);
+    mem_free_ts(grown);
+    
+    mem_latency_stats_t all = mem_get_latency(MEM_LATENCY_MALLOC, MEM_PATH_ALL);
+    assert(all.count == 1002);
+    assert(mem_get_latency(MEM_LATENCY_FREE, MEM_PATH_ALL).count == 1002);
+    assert(mem_get_latency(MEM_LATENCY_MALLOC, MEM_PATH_GROWTH).count >= 1);
+    assert(mem_get_latency(MEM_LATENCY_MALLOC, MEM_PATH_MMAP).count == 1);
+    assert(mem_get_latency(MEM_LATENCY_FREE, MEM_PATH_MMAP).count == 1);
+    if (mem_numa_nodes() == 1) {
+        assert(mem_get_latency(MEM_LATENCY_FREE, MEM_PATH_FAST).count > 0);
+    }
+    size_t by_path = 0;
+    for (int path = 0; path < MEM_PATHS; path++) {
+        by_path += mem_get_latency(MEM_LATENCY_MALLOC, path).count;
+    }
+    assert(by_path == all.count);
+    
+    /* Percentiles are ordered and bounded by the maximum */
+    assert(all.mean_ns > 0 && all.p50_ns > 0);
+    assert(all.p50_ns <= all.p90_ns && all.p90_ns <= all.p99_ns);
+    assert(all.p99_ns <= all.p999_ns && all.p999_ns <= all.max_ns);
+    /* (the tick rate is re-measured on each call, hence the tolerance) */
+    double max = mem_latency_percentile(MEM_LATENCY_MALLOC, MEM_PATH_ALL, 100);
+    double p50 = mem_latency_percentile(MEM_LATENCY_MALLOC, MEM_PATH_ALL, 50);
+    assert(max > all.max_ns * 0.99 && max < all.max_ns * 1.01);
+    assert(p50 > all.p50_ns * 0.99 && p50 < all.p50_ns * 1.01);
+    /* Mapping 40MB costs more than the median allocation */
+    assert(mem_get_latency(MEM_LATENCY_MALLOC, MEM_PATH_MMAP).max_ns > all.p50_ns);
+    
+    mem_latency_enable(0);
+    mem_free_ts(mem_malloc_ts(100));
+    assert(mem_get_latency(MEM_LATENCY_MALLOC, MEM_PATH_ALL).count == 1002);
+    mem_reset();
+    assert(mem_get_latency(MEM_LATENCY_FREE, MEM_PATH_ALL).count == 0);
+    
+    printf("  PASSED\n");
+}
+
+static pthread_barrier_t shard_barrier;
+
+static void* shard_worker(void* arg) {
+    int rounds = *(int*)arg;
+    void* ptrs[16];
+    
+    pthread_barrier_wait(&shard_barrier);
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < 16; i++) {
+            ptrs[i] = mem_malloc_ts(16 + (size_t)i * 100);
+        }
+        for (int i = 0; i < 16; i++) {
+            mem_free_ts(ptrs[i]);
+        }
+    }
+    return NULL;
+}
+
+/* Run threads that all exist at once */
+static void run_shard_workers(int threads, int rounds) {
+    pthread_t tids[200];
+    pthread_barrier_init(&shard_barrier, NULL, (unsigned)threads);
+    for (int i = 0; i < threads; i++) {
+        assert(pthread_create(&tids[i], NULL, shard_worker, &rounds) == 0);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    pthread_barrier_destroy(&shard_barrier);
+}
+
+/* Rewind a temporary file and read it back as a string */
+static size_t read_back(int fd, char* buf, size_t size) {
+    size_t len = 0;
+    ssize_t n;
+    assert(lseek(fd, 0, SEEK_SET) == 0);
+    while ((n = read(fd, buf + len, size - 1 - len)) > 0) {
+        len += (size_t)n;
+    }
+    buf[len] = '\0';
+    assert(ftruncate(fd, 0) == 0 && lseek(fd, 0, SEEK_SET) == 0);
+    return len;
+}
+
+void test_stats_export(void) {
+    printf("Test: Statistics export\n");
+    
+    char path[] = "/tmp/mem_stats_testXXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    unlink(path);
+    static char buf[256 * 1024];
+    char expect[128];
+    
+    void* small = mem_malloc(100);
+    void* large = mem_malloc(20000);
+    assert(small && large);
+    
+    /* JSON: one line; writing does not allocate */
+    mem_stats_t stats = mem_get_stats();
+    assert(mem_stats_write(fd, MEM_STATS_JSON) == 0);
+    assert(mem_get_stats().num_allocations == stats.num_allocations);
+    size_t len = read_back(fd, buf, sizeof(buf));
+    assert(buf[0] == '{' && strcmp(buf + len - 2, "}\n") == 0);
+    assert(strchr(buf, '\n') == buf + len - 1);
+    snprintf(expect, sizeof(expect), "\"num_allocations\":%zu,", stats.num_allocations);
+    assert(strstr(buf, expect) != NULL);
+    assert(strstr(buf, "\"size_classes\":[{\"max_block_size\":32,") != NULL);
+    assert(strstr(buf, "{\"max_block_size\":null,") != NULL);
+    assert(strstr(buf, "\"heap\":{\"heap_size\":") != NULL);
+    assert(strstr(buf, "\"fragmentation\":0.") || strstr(buf, "\"fragmentation\":1.000000"));
+    assert(strstr(buf, "\"latency\":{\"malloc\":{\"fast\":{\"count\":") != NULL);
+    
+    /* Prometheus text: counters, class labels, heap gauges, latency summary */
+    assert(mem_stats_write_ts(fd, MEM_STATS_PROMETHEUS) == 0);
+    read_back(fd, buf, sizeof(buf));
+    snprintf(expect, sizeof(expect), "# TYPE mem_allocations_total counter\nmem_allocations_total %zu\n",
+             stats.num_allocations);
+    assert(strstr(buf, expect) != NULL);
+    assert(strstr(buf, "mem_class_live_blocks{max_block_size=\"32\"} ") != NULL);
+    assert(strstr(buf, "mem_class_live_blocks{max_block_size=\"+Inf\"} 1\n") != NULL);
+    assert(strstr(buf, "\nmem_heap_fragmentation_ratio ") != NULL);
+    assert(strstr(buf, "mem_latency_seconds{op=\"malloc\",path=\"fast\",quantile=\"0.99\"} ") != NULL);
+    assert(strstr(buf, "\nmem_latency_seconds_count{op=\"free\",path=\"mmap\"} ") != NULL);
+    
+    errno = 0;
+    assert(mem_stats_write(fd, 2) == -1 && errno == EINVAL);
+    assert(mem_stats_write(-1, MEM_STATS_JSON) == -1 && errno == EBADF);
+    
+    /* The signal dump leaves out heap info */
+    assert(mem_stats_signal(SIGUSR1, fd, MEM_STATS_JSON) == 0);
+    raise(SIGUSR1);
+    read_back(fd, buf, sizeof(buf));
+    assert(strstr(buf, "\"num_allocations\":") != NULL);
+    assert(strstr(buf, "\"heap\":") == NULL);
+    signal(SIGUSR1, SIG_DFL);
+    
+    mem_free(small);
+    mem_free(large);
+    close(fd);
+    printf("  PASSED\n");
+}
+
+void test_stat_shards(void) {
+    printf("Test: Per-thread statistics shards\n");
+    
+    /* Counts made on other threads, including ones that have exited,
+     * add up in the totals */
+    mem_stats_t before = mem_get_stats();
+    run_shard_workers(8, 500);
+    mem_stats_t after = mem_get_stats();
+    assert(after.num_allocations - before.num_allocations == 8 * 500 * 16);
+    assert(after.num_frees - before.num_frees == 8 * 500 * 16);
+    assert(after.current_usage == before.current_usage);
+    
+    /* More threads than shards: the rest share the overflow shard */
+    run_shard_workers(200, 10);
+    mem_stats_t overflow = mem_get_stats();
+    assert(overflow.num_allocations - after.num_allocations == 200 * 10 * 16);
+    assert(overflow.current_usage == before.current_usage);
+    
+    printf("  PASSED\n");
+}
+
 void test_thread_safe_functions(void) {
     printf("Test: Thread-safe functions\n");
     
@@ -137,6 +706,545 @@ void test_thread_safe_functions(void) {
     printf("  PASSED\n");
 }
 
+void test_numa_allocation(void) {
+    printf("Test: NUMA node-targeted allocation\n");
+    
+    int nodes = mem_numa_nodes();
+    assert(nodes >= 1);
+    printf("  NUMA nodes: %d\n", nodes);
+    
+    for (int node = 0; node < nodes; node++) {
+        char* small = (char*)mem_malloc_onnode(100, node);
+        char* large = (char*)mem_malloc_onnode_ts(256 * 1024, node);
+        assert(small != NULL);
+        assert(large != NULL);
+        
+        memset(small, 'N', 100);
+        memset(large, 'N', 256 * 1024);
+        
+        mem_free(small);
+        mem_free_ts(large);
+    }
+    
+    /* Nodes that do not exist are rejected */
+    assert(mem_malloc_onnode(100, nodes) == NULL);
+    assert(mem_malloc_onnode(100, -1) == NULL);
+    
+    printf("  PASSED\n");
+}
+
+void test_reserve(void) {
+    printf("Test: Heap pre-reservation\n");
+    
+    assert(mem_reserve(0, 0) == -1);
+    assert(mem_reserve(1024 * 1024, MEM_RESERVE_PREFAULT) == 0);
+    
+    /* Reserved memory satisfies later requests */
+    void* ptrs[64];
+    for (int i = 0; i < 64; i++) {
+        ptrs[i] = mem_malloc(1000);
+        assert(ptrs[i] != NULL);
+        memset(ptrs[i], 'R', 1000);
+    }
+    for (int i = 0; i < 64; i++) {
+        mem_free(ptrs[i]);
+    }
+    
+    /* Locking may be refused by RLIMIT_MEMLOCK; the memory is usable either way */
+    int locked = mem_reserve_ts(64 * 1024, MEM_RESERVE_PREFAULT | MEM_RESERVE_LOCK);
+    printf("  Locked reservation: %s\n", locked == 0 ? "yes" : "no");
+    
+    printf("  PASSED\n");
+}
+
+void test_growth_policy(void) {
+    printf("Test: Geometric heap growth\n");
+    
+    mem_growth_policy_t saved = mem_get_growth_policy();
+    mem_growth_policy_t policy = { 64 * 1024, 1024 * 1024, 100 };
+    mem_set_growth_policy(&policy);
+    
+    mem_reset();
+    
+    /* 4MB of small blocks would take 64 expansions at a fixed 64KB step */
+    void* ptrs[4096];
+    for (int i = 0; i < 4096; i++) {
+        ptrs[i] = mem_malloc(1000);
+        assert(ptrs[i] != NULL);
+    }
+    
+    mem_stats_t stats = mem_get_stats();
+    printf("  Expansions: %zu (%zu ns)\n", stats.num_expansions, stats.growth_ns);
+    assert(stats.num_expansions < 16);
+    
+    for (int i = 0; i < 4096; i++) {
+        mem_free(ptrs[i]);
+    }
+    
+    mem_set_growth_policy(&saved);
+    printf("  PASSED\n");
+}
+
+void test_top_chunk(void) {
+    printf("Test: Top chunk reuse and trimming\n");
+    
+    mem_reset();
+    
+    /* A freed block at the end of the heap is extended, not wasted */
+    void* tail = mem_malloc(60 * 1024);
+    assert(tail != NULL);
+    mem_free(tail);
+    
+    void* bigger = mem_malloc(70 * 1024);
+    assert(bigger == tail);
+    memset(bigger, 'T', 70 * 1024);
+    mem_free(bigger);
+    
+    size_t size_before = mem_get_heap_info().heap_size;
+    size_t released = mem_trim(0);
+    printf("  Trimmed: %zu bytes\n", released);
+    assert(released > 0);
+    assert(mem_get_heap_info().heap_size < size_before);
+    
+    /* The heap keeps working after trimming */
+    void* ptr = mem_malloc(100 * 1024);
+    assert(ptr != NULL);
+    memset(ptr, 'T', 100 * 1024);
+    mem_free(ptr);
+    
+    printf("  PASSED\n");
+}
+
+void test_large_extents(void) {
+    printf("Test: Large-object extents\n");
+    
+    size_t mappings_before = mem_get_stats().num_mappings;
+    
+    /* Many large buffers share a few regions instead of one mapping each */
+    void* ptrs[512];
+    for (int i = 0; i < 512; i++) {
+        ptrs[i] = mem_malloc(200 * 1024);
+        assert(ptrs[i] != NULL);
+        memset(ptrs[i], 'E', 200 * 1024);
+    }
+    size_t mappings = mem_get_stats().num_mappings - mappings_before;
+    printf("  New mappings for 512 large buffers: %zu\n", mappings);
+    assert(mappings < 4);
+    
+    /* Adjacent freed extents coalesce into one */
+    void* first = ptrs[100];
+    mem_free(ptrs[100]);
+    mem_free(ptrs[102]);
+    mem_free(ptrs[101]);
+    void* merged = mem_malloc(600 * 1024);
+    assert(merged == first);
+    mem_free(merged);
+    ptrs[100] = ptrs[101] = ptrs[102] = NULL;
+    
+    for (int i = 0; i < 512; i++) {
+        mem_free(ptrs[i]);
+    }
+    
+    /* Truly huge requests still get their own mapping */
+    void* huge = mem_malloc(64 * 1024 * 1024);
+    assert(huge != NULL);
+    assert(mem_get_stats().num_mappings == mappings_before + mappings + 1);
+    mem_free(huge);
+    assert(mem_get_stats().num_mappings == mappings_before + mappings);
+    
+    printf("  PASSED\n");
+}
+
+void test_arena(void) {
+    printf("Test: Arena allocation\n");
+    
+    mem_arena_t* arena = mem_arena_create(4096);
+    assert(arena != NULL);
+    
+    /* Bump allocations span several chunks */
+    char* first = (char*)mem_arena_alloc(arena, 100);
+    assert(first != NULL);
+    for (int i = 0; i < 1000; i++) {
+        char* ptr = (char*)mem_arena_alloc(arena, 1 + i % 200);
+        assert(ptr != NULL);
+        assert(((uintptr_t)ptr & 15) == 0);
+        memset(ptr, 'A', 1 + i % 200);
+    }
+    
+    void* aligned = mem_arena_alloc_aligned(arena, 64, 256);
+    assert(aligned != NULL);
+    assert(((uintptr_t)aligned & 255) == 0);
+    assert(mem_arena_alloc_aligned(arena, 64, 24) == NULL);
+    
+    /* Larger than a chunk */
+    void* big = mem_arena_alloc(arena, 100000);
+    assert(big != NULL);
+    memset(big, 'B', 100000);
+    
+    /* Reset releases everything at once and reuses the chunks */
+    mem_arena_reset(arena);
+    assert(mem_arena_alloc(arena, 100) == first);
+    for (int i = 0; i < 1000; i++) {
+        assert(mem_arena_alloc(arena, 1 + i % 200) != NULL);
+    }
+    
+    mem_arena_destroy(arena);
+    printf("  PASSED\n");
+}
+
+void test_pool(void) {
+    printf("Test: Fixed-size object pool\n");
+    
+    mem_pool_t* pool = mem_pool_create(48, 64);
+    assert(pool != NULL);
+    assert(mem_pool_create(48, 24) == NULL);
+    
+    void* objs[1000];
+    for (int i = 0; i < 1000; i++) {
+        objs[i] = mem_pool_alloc(pool);
+        assert(objs[i] != NULL);
+        assert(((uintptr_t)objs[i] & 63) == 0);
+        memset(objs[i], 'P', 48);
+    }
+    
+    mem_pool_stats_t stats = mem_pool_get_stats(pool);
+    assert(stats.in_use == 1000);
+    assert(stats.capacity >= 1000);
+    printf("  Slabs: %zu, capacity: %zu\n", stats.num_slabs, stats.capacity);
+    
+    /* Freed objects are reused LIFO */
+    mem_pool_free(pool, objs[10]);
+    assert(mem_pool_alloc(pool) == objs[10]);
+    
+    for (int i = 0; i < 1000; i++) {
+        mem_pool_free_ts(pool, objs[i]);
+    }
+    void* obj = mem_pool_alloc_ts(pool);
+    assert(obj == objs[999]);
+    mem_pool_free_ts(pool, obj);
+    
+    stats = mem_pool_get_stats(pool);
+    assert(stats.in_use == 0);
+    assert(stats.num_allocations == stats.num_frees);
+    
+    mem_pool_destroy(pool);
+    printf("  PASSED\n");
+}
+
+/* Recursive helper: each level allocates scratch memory in its own frame */
+static void frame_recurse(int depth) {
+    mem_frame_mark_t mark = mem_frame_mark();
+    
+    char* scratch = (char*)mem_frame_alloc(1000);
+    assert(scratch != NULL);
+    memset(scratch, 'a' + depth % 26, 1000);
+    
+    if (depth < 100) {
+        frame_recurse(depth + 1);
+    }
+    
+    /* Deeper frames did not touch this one */
+    for (int i = 0; i < 1000; i++) {
+        assert(scratch[i] == 'a' + depth % 26);
+    }
+    
+    mem_frame_release(mark);
+}
+
+void test_frame(void) {
+    printf("Test: Frame allocator\n");
+    
+    mem_frame_mark_t outer = mem_frame_mark();
+    void* first = mem_frame_alloc(64);
+    assert(first != NULL);
+    
+    frame_recurse(0);
+    
+    /* Released frames are reused */
+    mem_frame_mark_t mark = mem_frame_mark();
+    void* again = mem_frame_alloc(64);
+    mem_frame_release(mark);
+    assert(mem_frame_alloc(64) == again);
+    
+    mem_frame_release(outer);
+    assert(mem_frame_alloc(64) == first);
+    mem_frame_release(outer);
+    
+    printf("  PASSED\n");
+}
+
+void test_heap_instances(void) {
+    printf("Test: Heap instances\n");
+    
+    mem_stats_t default_before = mem_get_stats();
+    
+    mem_heap_t* heap = mem_heap_create();
+    assert(heap != NULL);
+    
+    /* Small, large and huge allocations all come from the instance */
+    void* small = mem_heap_malloc(heap, 100);
+    void* large = mem_heap_malloc(heap, 512 * 1024);
+    void* huge = mem_heap_malloc(heap, 64 * 1024 * 1024);
+    assert(small != NULL && large != NULL && huge != NULL);
+    memset(small, 'S', 100);
+    memset(large, 'L', 512 * 1024);
+    memset(huge, 'H', 64 * 1024 * 1024);
+    assert(((uintptr_t)huge & 4095) == 0);
+    
+    mem_stats_t stats = mem_heap_get_stats(heap);
+    assert(stats.num_allocations == 3);
+    assert(stats.current_usage >= 100 + 512 * 1024 + 64 * 1024 * 1024);
+    
+    /* The default heap's accounting is untouched */
+    assert(mem_get_stats().num_allocations == default_before.num_allocations);
+    
+    int* arr = mem_heap_calloc(heap, 50, sizeof(int));
+    assert(arr != NULL && arr[49] == 0);
+    small = mem_heap_realloc(heap, small, 4000);
+    assert(small != NULL && ((char*)small)[99] == 'S');
+    
+    mem_heap_free(heap, huge);
+    mem_heap_free(heap, arr);
+    stats = mem_heap_get_stats(heap);
+    assert(stats.num_frees == 3);
+    
+    /* Destroy releases the remaining allocations in one step */
+    for (int i = 0; i < 1000; i++) {
+        assert(mem_heap_malloc(heap, 64) != NULL);
+    }
+    mem_heap_destroy(heap);
+    
+    printf("  PASSED\n");
+}
+
+void test_heap_in_buffer(void) {
+    printf("Test: Heap over a caller buffer\n");
+    
+    static char buffer[256 * 1024];
+    mem_heap_t* heap = mem_heap_create_in(buffer, sizeof(buffer));
+    assert(heap != NULL);
+    assert(mem_heap_create_in(buffer, 64) == NULL);
+    
+    /* All blocks, even large ones, come from inside the buffer */
+    void* ptrs[64];
+    for (int i = 0; i < 64; i++) {
+        ptrs[i] = mem_heap_malloc(heap, 1000);
+        assert(ptrs[i] != NULL);
+        assert((char*)ptrs[i] > buffer && (char*)ptrs[i] + 1000 <= buffer + sizeof(buffer));
+        memset(ptrs[i], 'B', 1000);
+    }
+    void* large = mem_heap_malloc(heap, 150 * 1024);
+    assert(large != NULL);
+    assert((char*)large > buffer && (char*)large + 150 * 1024 <= buffer + sizeof(buffer));
+    
+    /* The buffer is never grown */
+    assert(mem_heap_malloc(heap, 200 * 1024) == NULL);
+    
+    /* Freed neighbours coalesce back into one large block (coalescing
+     * is forward-only, so free from the end) */
+    for (int i = 63; i >= 0; i--) {
+        mem_heap_free(heap, ptrs[i]);
+    }
+    void* merged = mem_heap_malloc(heap, 60 * 1000);
+    assert(merged == ptrs[0]);
+    mem_heap_free(heap, merged);
+    mem_heap_free(heap, large);
+    
+    mem_stats_t stats = mem_heap_get_stats(heap);
+    assert(stats.current_usage == 0);
+    assert(stats.num_mappings == 0);
+    mem_heap_destroy(heap);
+    
+    printf("  PASSED\n");
+}
+
+void test_shared_heap(void) {
+    printf("Test: Shared-memory heap\n");
+    
+    int fd = memfd_create("test_heap", MFD_CLOEXEC);
+    assert(fd >= 0);
+    mem_heap_t* heap = mem_heap_create_shared(fd, 1024 * 1024);
+    assert(heap != NULL);
+    
+    int pipefd[2];
+    assert(pipe(pipefd) == 0);
+    
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        /* A second mapping of the same heap lands at another address */
+        mem_heap_t* view = mem_heap_attach_shared(fd);
+        if (!view || view == heap) {
+            _exit(1);
+        }
+        char* msg = mem_heap_malloc(view, 64);
+        if (!msg) {
+            _exit(1);
+        }
+        strcpy(msg, "hello from the child");
+        size_t offset = mem_heap_offset(view, msg);
+        if (write(pipefd[1], &offset, sizeof(offset)) != sizeof(offset)) {
+            _exit(1);
+        }
+        mem_heap_destroy(view);
+        _exit(0);
+    }
+    
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    
+    /* The child's object is readable and freeable here without copying */
+    size_t offset;
+    assert(read(pipefd[0], &offset, sizeof(offset)) == sizeof(offset));
+    char* msg = mem_heap_pointer(heap, offset);
+    assert(strcmp(msg, "hello from the child") == 0);
+    mem_heap_free(heap, msg);
+    
+    mem_stats_t stats = mem_heap_get_stats(heap);
+    assert(stats.num_allocations == 1 && stats.num_frees == 1);
+    assert(stats.current_usage == 0);
+    
+    /* Anything that is not a shared heap is rejected */
+    int bad = memfd_create("not_a_heap", MFD_CLOEXEC);
+    assert(bad >= 0 && ftruncate(bad, 65536) == 0);
+    assert(mem_heap_attach_shared(bad) == NULL);
+    
+    close(bad);
+    close(pipefd[0]);
+    close(pipefd[1]);
+    mem_heap_destroy(heap);
+    close(fd);
+    
+    printf("  PASSED\n");
+}
+
+typedef struct persist_node {
+    int value;
+    size_t next;  /* Heap offset of the next node */
+} persist_node_t;
+
+void test_persistent_heap(void) {
+    printf("Test: File-backed persistent heap\n");
+    
+    char path[] = "/tmp/mem_heap_testXXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+    
+    /* Build a list and publish it through the root */
+    mem_heap_t* heap = mem_heap_open_file(path, 1024 * 1024);
+    assert(heap != NULL);
+    assert(mem_heap_get_root(heap) == NULL);
+    size_t head = 0;
+    for (int i = 0; i < 100; i++) {
+        persist_node_t* node = mem_heap_malloc(heap, sizeof(persist_node_t));
+        assert(node != NULL);
+        node->value = i;
+        node->next = head;
+        head = mem_heap_offset(heap, node);
+    }
+    mem_heap_set_root(heap, mem_heap_pointer(heap, head));
+    mem_heap_destroy(heap);
+    
+    /* Reopen: the list is there without rebuilding anything */
+    heap = mem_heap_open_file(path, 0);
+    assert(heap != NULL);
+    int expected = 99;
+    for (persist_node_t* node = mem_heap_get_root(heap); node;
+         node = mem_heap_pointer(heap, node->next)) {
+        assert(node->value == expected--);
+    }
+    assert(expected == -1);
+    mem_heap_destroy(heap);
+    
+    /* A process that dies without closing leaves the heap recoverable */
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        mem_heap_t* child_heap = mem_heap_open_file(path, 0);
+        persist_node_t* root = mem_heap_get_root(child_heap);
+        for (int i = 0; i < 50; i++) {
+            mem_heap_free(child_heap, mem_heap_malloc(child_heap, 200));
+        }
+        root->value = 1000;
+        _exit(0);
+    }
+    int status;
+    assert(waitpid(pid, &status, 0) == pid && WIFEXITED(status));
+    
+    heap = mem_heap_open_file(path, 0);
+    assert(heap != NULL);
+    persist_node_t* root = mem_heap_get_root(heap);
+    assert(root->value == 1000);
+    void* p = mem_heap_malloc(heap, 200);
+    assert(p != NULL);
+    mem_heap_free(heap, p);
+    
+    /* A second handle on a file in use shares it instead of recovering:
+     * the free list keeps its LIFO order rather than being rebuilt in
+     * address order, so the block freed last is handed out first */
+    void* fence[3];
+    void* x;
+    void* y;
+    fence[0] = mem_heap_malloc(heap, 3000);
+    x = mem_heap_malloc(heap, 3000);
+    fence[1] = mem_heap_malloc(heap, 3000);
+    y = mem_heap_malloc(heap, 3000);
+    fence[2] = mem_heap_malloc(heap, 3000);
+    assert(fence[0] && x && fence[1] && y && fence[2]);
+    mem_heap_free(heap, y);
+    mem_heap_free(heap, x);
+    mem_heap_t* other = mem_heap_open_file(path, 0);
+    assert(other != NULL && other != heap);
+    assert(mem_heap_malloc(heap, 3000) == x);
+    mem_heap_free(heap, x);
+    for (int i = 0; i < 3; i++) {
+        mem_heap_free(heap, fence[i]);
+    }
+    persist_node_t* a = mem_heap_malloc(heap, sizeof(persist_node_t));
+    persist_node_t* b = mem_heap_malloc(other, sizeof(persist_node_t));
+    assert(a != NULL && b != NULL);
+    assert(mem_heap_offset(heap, a) != mem_heap_offset(other, b));
+    a->value = 7;
+    persist_node_t* a_seen = mem_heap_pointer(other, mem_heap_offset(heap, a));
+    assert(a_seen->value == 7);
+    
+    /* Closing one handle leaves the other usable */
+    mem_heap_destroy(heap);
+    void* c = mem_heap_malloc(other, 200);
+    assert(c != NULL);
+    assert(mem_heap_offset(other, c) != mem_heap_offset(other, b));
+    assert(mem_heap_offset(other, c) != mem_heap_offset(other, a_seen));
+    mem_heap_free(other, c);
+    
+    /* A process dying with a handle open while this one is open */
+    pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        mem_heap_t* child_heap = mem_heap_open_file(path, 0);
+        mem_heap_malloc(child_heap, 300);
+        _exit(0);
+    }
+    assert(waitpid(pid, &status, 0) == pid && WIFEXITED(status));
+    persist_node_t* d = mem_heap_malloc(other, sizeof(persist_node_t));
+    assert(d != NULL && d != b && d != a_seen);
+    mem_heap_free(other, d);
+    mem_heap_free(other, a_seen);
+    mem_heap_free(other, b);
+    mem_heap_destroy(other);
+    
+    /* The data written through either handle survives */
+    heap = mem_heap_open_file(path, 0);
+    assert(heap != NULL);
+    root = mem_heap_get_root(heap);
+    assert(root->value == 1000);
+    mem_heap_destroy(heap);
+    
+    unlink(path);
+    printf("  PASSED\n");
+}
+
 int main(void) {
     printf("Custom Memory Allocator Test Suite\n");
     printf("===================================\n\n");
@@ -146,9 +1254,31 @@ int main(void) {
     test_calloc();
     test_realloc();
     test_large_allocation();
+    test_huge_sizes();
     test_coalescing();
     test_splitting();
+    test_memalign();
+    test_fast_path();
+    test_class_stats();
+    test_heap_info();
+    test_heap_walk();
+    test_heap_profile();
+    test_latency_histograms();
+    test_stats_export();
+    test_stat_shards();
     test_thread_safe_functions();
+    test_numa_allocation();
+    test_reserve();
+    test_growth_policy();
+    test_top_chunk();
+    test_large_extents();
+    test_arena();
+    test_pool();
+    test_frame();
+    test_heap_instances();
+    test_heap_in_buffer();
+    test_shared_heap();
+    test_persistent_heap();
     
     printf("\n=== Final Statistics ===\n");
     mem_print_stats();
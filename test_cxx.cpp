@@ -0,0 +1,312 @@
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <list>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <thread>
+#include "allocator.h"
+#include "allocator_heap.hpp"
+#include "allocator_pmr.hpp"
+#include "allocator_pool.hpp"
+
+/* C++ integration tests; linked with allocator_new.o */
+
+struct alignas(256) over_aligned {
+    char data[100];
+};
+
+void test_operator_new() {
+    std::printf("Test: Global operator new/delete\n");
+
+    mem_stats_t before = mem_get_stats();
+
+    /* Both blocks are the allocator's own (this also keeps the compiler
+     * from eliding the new/delete pairs) */
+    int* value = new int(42);
+    int* array = new int[1000];
+    array[999] = *value;
+    assert(mem_usable_size(value) >= sizeof(int));
+    assert(mem_usable_size(array) >= 1000 * sizeof(int));
+    assert(mem_get_stats().num_allocations == before.num_allocations + 2);
+    delete value;
+    delete[] array;
+
+    /* Library containers go through the replacement too */
+    {
+        std::vector<std::string> strings;
+        for (int i = 0; i < 100; i++) {
+            strings.push_back(std::string(100, static_cast<char>('a' + i % 26)));
+        }
+        auto shared = std::make_shared<std::vector<int>>(5000, 7);
+        assert((*shared)[4999] == 7);
+    }
+    /* Everything allocated was freed through the allocator */
+    mem_stats_t stats = mem_get_stats();
+    assert(stats.num_allocations > before.num_allocations + 100);
+    assert(stats.num_allocations - before.num_allocations == stats.num_frees - before.num_frees);
+
+    /* Over-aligned types use the align_val_t overloads */
+    over_aligned* one = new over_aligned;
+    over_aligned* many = new over_aligned[10];
+    assert(reinterpret_cast<uintptr_t>(one) % 256 == 0);
+    assert(reinterpret_cast<uintptr_t>(many) % 256 == 0);
+    delete one;
+    delete[] many;
+
+    /* nothrow new reports failure with nullptr */
+    void* huge = ::operator new(static_cast<size_t>(-1) / 2, std::nothrow);
+    assert(huge == nullptr);
+
+    bool threw = false;
+    try {
+        void* too_big = ::operator new(static_cast<size_t>(-1) / 2);
+        (void)too_big;
+    } catch (const std::bad_alloc&) {
+        threw = true;
+    }
+    assert(threw);
+
+    std::printf("  PASSED\n");
+}
+
+void test_pmr_resources() {
+    std::printf("Test: std::pmr memory resources\n");
+
+    /* Default heap */
+    mem_stats_t before = mem_get_stats();
+    {
+        std::pmr::vector<int> v(mem::default_resource());
+        for (int i = 0; i < 1000; i++) {
+            v.push_back(i);
+        }
+        void* aligned = mem::default_resource()->allocate(100, 128);
+        assert(reinterpret_cast<uintptr_t>(aligned) % 128 == 0);
+        mem::default_resource()->deallocate(aligned, 100, 128);
+    }
+    mem_stats_t after = mem_get_stats();
+    assert(after.num_allocations > before.num_allocations);
+    assert(after.num_allocations - before.num_allocations == after.num_frees - before.num_frees);
+
+    /* Heap instance: usage is charged to that heap only */
+    mem_heap_t* heap = mem_heap_create();
+    mem::heap_resource heap_res(heap);
+    {
+        std::pmr::vector<std::pmr::string> words(&heap_res);
+        for (int i = 0; i < 100; i++) {
+            words.emplace_back(64, 'w');
+        }
+        assert(mem_heap_get_stats(heap).current_usage > 100 * 64);
+        void* aligned = heap_res.allocate(10, 4096);
+        assert(reinterpret_cast<uintptr_t>(aligned) % 4096 == 0);
+        heap_res.deallocate(aligned, 10, 4096);
+    }
+    assert(mem_heap_get_stats(heap).current_usage == 0);
+    mem::heap_resource same_heap(heap);
+    assert(heap_res == same_heap);
+    assert(!(heap_res == *mem::default_resource()));
+    mem_heap_destroy(heap);
+
+    /* Arena: deallocation is free, reset reclaims everything */
+    mem_arena_t* arena = mem_arena_create(0);
+    mem::arena_resource arena_res(arena);
+    {
+        std::pmr::list<int> l(&arena_res);
+        for (int i = 0; i < 1000; i++) {
+            l.push_back(i);
+        }
+        void* aligned = arena_res.allocate(8, 256);
+        assert(reinterpret_cast<uintptr_t>(aligned) % 256 == 0);
+    }
+    mem_arena_reset(arena);
+    mem_arena_destroy(arena);
+
+    /* Pool: list nodes come from the pool, larger requests go upstream */
+    mem_pool_t* pool = mem_pool_create(64, 0);
+    mem::pool_resource pool_res(pool);
+    {
+        std::pmr::list<int> l(&pool_res);
+        for (int i = 0; i < 500; i++) {
+            l.push_back(i);
+        }
+        assert(mem_pool_get_stats(pool).in_use == 500);
+        void* big = pool_res.allocate(1000, 16);
+        assert(mem_pool_get_stats(pool).in_use == 500);
+        pool_res.deallocate(big, 1000, 16);
+    }
+    assert(mem_pool_get_stats(pool).in_use == 0);
+    mem_pool_destroy(pool);
+
+    std::printf("  PASSED\n");
+}
+
+/* Random allocate/free with content checks against any heap type */
+template <class Heap>
+void exercise_heap(Heap& heap, unsigned seed, std::size_t max_size) {
+    void* ptrs[256] = {};
+    std::size_t sizes[256] = {};
+    for (int i = 0; i < 20000; i++) {
+        seed = seed * 1103515245u + 12345u;
+        int idx = (seed >> 8) % 256;
+        if (ptrs[idx]) {
+            unsigned char* bytes = static_cast<unsigned char*>(ptrs[idx]);
+            for (std::size_t k = 0; k < sizes[idx]; k++) {
+                assert(bytes[k] == static_cast<unsigned char>(idx));
+            }
+            heap.free(ptrs[idx]);
+            ptrs[idx] = nullptr;
+        } else {
+            sizes[idx] = (seed >> 4) % max_size + 1;
+            ptrs[idx] = heap.malloc(sizes[idx]);
+            assert(ptrs[idx] != nullptr);
+            assert(reinterpret_cast<uintptr_t>(ptrs[idx]) % 16 == 0);
+            std::memset(ptrs[idx], idx, sizes[idx]);
+        }
+    }
+    for (int i = 0; i < 256; i++) {
+        heap.free(ptrs[i]);
+    }
+}
+
+void test_policy_heaps() {
+    std::printf("Test: Policy-based heap template\n");
+
+    /* The size-class table is computed at compile time */
+    using classes = mem::pow2_size_classes<>;
+    static_assert(classes::index(32) == 0 && classes::index(33) == 1, "class bounds");
+    static_assert(classes::index(8192) == 8 && classes::index(8193) == 9, "class bounds");
+    static_assert(classes::limits[8] == 8192, "class table");
+
+    /* Disabled policies take no space */
+    using counted = mem::basic_heap<classes, mem::no_lock, mem::fixed_backend, mem::basic_stats>;
+    static_assert(sizeof(mem::fixed_heap) + sizeof(mem_stats_t) == sizeof(counted), "no_stats is free");
+
+    /* Default heap: same algorithm and statistics as mem_malloc */
+    mem::heap heap;
+    exercise_heap(heap, 1, 4000);
+    void* large = heap.malloc(512 * 1024);
+    assert(large != nullptr);
+    std::memset(large, 1, 512 * 1024);
+    heap.free(large);
+    mem_stats_t stats = heap.stats();
+    assert(stats.num_allocations == stats.num_frees);
+    assert(stats.current_usage == 0);
+    assert(stats.num_splits > 0 && stats.num_coalesces > 0);
+
+    /* Locked heap shared between threads */
+    mem::locked_heap shared;
+    std::thread a([&] { exercise_heap(shared, 2, 2000); });
+    std::thread b([&] { exercise_heap(shared, 3, 2000); });
+    a.join();
+    b.join();
+    assert(shared.stats().current_usage == 0);
+
+    /* Fixed buffer: everything stays inside it */
+    alignas(16) static char buffer[1024 * 1024];
+    mem::fixed_heap fixed(buffer, sizeof(buffer));
+    exercise_heap(fixed, 4, 1000);
+    int* arr = static_cast<int*>(fixed.calloc(100, sizeof(int)));
+    assert(arr != nullptr && arr[99] == 0);
+    assert(reinterpret_cast<char*>(arr) > buffer && reinterpret_cast<char*>(arr) < buffer + sizeof(buffer));
+    arr = static_cast<int*>(fixed.realloc(arr, 1000 * sizeof(int)));
+    assert(arr != nullptr && arr[99] == 0);
+    fixed.free(arr);
+    assert(fixed.malloc(2 * 1024 * 1024) == nullptr);
+
+    std::printf("  PASSED\n");
+}
+
+struct tracked {
+    static int live;
+    int value;
+    explicit tracked(int v) : value(v) {
+        if (v < 0) {
+            throw std::runtime_error("negative");
+        }
+        live++;
+    }
+    ~tracked() { live--; }
+};
+int tracked::live = 0;
+
+void test_object_pool() {
+    std::printf("Test: Typed object pools\n");
+
+    /* Thread-local pool: construction, destruction and reuse */
+    {
+        auto a = mem::make_pooled<tracked>(1);
+        auto b = mem::make_pooled<tracked>(2);
+        assert(a->value == 1 && b->value == 2 && tracked::live == 2);
+        assert(mem::object_pool<tracked>::local().stats().in_use == 2);
+        tracked* old = a.get();
+        a.reset();
+        assert(tracked::live == 1);
+        auto c = mem::make_pooled<tracked>(3);
+        assert(c.get() == old);
+    }
+    assert(tracked::live == 0);
+    assert(mem::object_pool<tracked>::local().stats().in_use == 0);
+
+    /* A throwing constructor gives the memory back */
+    bool threw = false;
+    try {
+        mem::make_pooled<tracked>(-1);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw && mem::object_pool<tracked>::local().stats().in_use == 0);
+
+    /* Each thread has its own pool */
+    mem_pool_t* main_pool = mem::object_pool<tracked>::local().pool();
+    std::thread([&] {
+        auto p = mem::make_pooled<tracked>(4);
+        assert(mem::object_pool<tracked>::local().pool() != main_pool);
+    }).join();
+
+    /* Explicit pools, over-aligned types */
+    mem::object_pool<over_aligned> aligned;
+    over_aligned* raw = aligned.construct();
+    assert(reinterpret_cast<uintptr_t>(raw) % 256 == 0);
+    aligned.destroy(raw);
+
+    /* Locked pool shared between threads */
+    mem::object_pool<tracked, true> shared;
+    std::vector<mem::object_pool<tracked, true>::pointer> kept[2];
+    std::thread t1([&] { for (int i = 0; i < 1000; i++) kept[0].push_back(shared.make(i)); });
+    std::thread t2([&] { for (int i = 0; i < 1000; i++) kept[1].push_back(shared.make(i)); });
+    t1.join();
+    t2.join();
+    assert(shared.stats().in_use == 2000 && tracked::live == 2000);
+    kept[0].clear();
+    kept[1].clear();
+    assert(shared.stats().in_use == 0 && tracked::live == 0);
+
+    /* Pointers may outlive the pool object */
+    mem::object_pool<tracked>::pointer survivor;
+    {
+        mem::object_pool<tracked> scoped;
+        survivor = scoped.make(5);
+    }
+    assert(survivor->value == 5);
+    survivor.reset();
+    assert(tracked::live == 0);
+
+    std::printf("  PASSED\n");
+}
+
+int main() {
+    std::printf("Custom Memory Allocator C++ Test Suite\n");
+    std::printf("======================================\n\n");
+
+    test_operator_new();
+    test_pmr_resources();
+    test_policy_heaps();
+    test_object_pool();
+
+    std::printf("\nAll C++ tests passed!\n");
+    return 0;
+}
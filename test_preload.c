@@ -0,0 +1,187 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <pthread.h>
+
+/**
+ * Tests for the LD_PRELOAD shim. Built against libc only and run as
+ *
+ *   LD_PRELOAD=./liballocator_preload.so ./test_preload
+ *
+ * so every call below goes through the exported malloc family.
+ */
+
+/* Sizes are read through a volatile so the compiler cannot fold the calls */
+static volatile size_t huge = SIZE_MAX - 64;
+
+void test_shim_loaded(void) {
+    printf("Test: Shim is preloaded\n");
+    
+    assert(dlsym(RTLD_DEFAULT, "mem_malloc_ts") != NULL);
+    
+    printf("  PASSED\n");
+}
+
+void test_huge_sizes(void) {
+    printf("Test: Huge sizes fail with ENOMEM\n");
+    
+    errno = 0;
+    assert(malloc(huge) == NULL && errno == ENOMEM);
+    errno = 0;
+    assert(calloc(huge / 2, 4) == NULL && errno == ENOMEM);
+    errno = 0;
+    assert(memalign(16, huge) == NULL && errno == ENOMEM);
+    errno = 0;
+    assert(memalign(4096, huge) == NULL && errno == ENOMEM);
+    errno = 0;
+    assert(aligned_alloc(64, huge) == NULL && errno == ENOMEM);
+    errno = 0;
+    assert(valloc(huge) == NULL && errno == ENOMEM);
+    errno = 0;
+    assert(pvalloc(SIZE_MAX - 10) == NULL && errno == ENOMEM);
+    
+    /* A failed realloc leaves the block alone */
+    char* ptr = malloc(100);
+    assert(ptr != NULL);
+    memset(ptr, 'R', 100);
+    errno = 0;
+    assert(realloc(ptr, huge) == NULL && errno == ENOMEM);
+    assert(ptr[99] == 'R');
+    free(ptr);
+    
+    printf("  PASSED\n");
+}
+
+void test_memalign_errno(void) {
+    printf("Test: memalign errno\n");
+    
+    /* A stale EINVAL must not leak into an out-of-memory failure */
+    errno = EINVAL;
+    assert(memalign(64, huge) == NULL && errno == ENOMEM);
+    
+    errno = 0;
+    assert(memalign(0, 16) == NULL && errno == EINVAL);
+    errno = 0;
+    assert(memalign(24, 16) == NULL && errno == EINVAL);
+    
+    void* ptr = memalign(256, 1000);
+    assert(ptr != NULL && ((uintptr_t)ptr & 255) == 0);
+    free(ptr);
+    
+    printf("  PASSED\n");
+}
+
+void test_posix_memalign(void) {
+    printf("Test: posix_memalign\n");
+    
+    void* ptr = (void*)1;
+    assert(posix_memalign(&ptr, 0, 16) == EINVAL);
+    assert(posix_memalign(&ptr, 4, 16) == EINVAL);
+    assert(posix_memalign(&ptr, 48, 16) == EINVAL);
+    assert(posix_memalign(&ptr, 64, huge) == ENOMEM);
+    assert(ptr == (void*)1);  /* Untouched on failure */
+    
+    assert(posix_memalign(&ptr, 64, 1000) == 0);
+    assert(ptr != NULL && ((uintptr_t)ptr & 63) == 0);
+    memset(ptr, 'P', 1000);
+    free(ptr);
+    
+    assert(posix_memalign(&ptr, 4096, 0) == 0);
+    free(ptr);
+    
+    printf("  PASSED\n");
+}
+
+void test_zero_sizes(void) {
+    printf("Test: Zero sizes\n");
+    
+    /* malloc(0) returns distinct pointers that can be freed */
+    void* a = malloc(0);
+    void* b = malloc(0);
+    assert(a != NULL && b != NULL && a != b);
+    free(a);
+    free(b);
+    
+    /* realloc(p, 0) frees p; realloc(NULL, n) allocates */
+    char* ptr = realloc(NULL, 64);
+    assert(ptr != NULL);
+    memset(ptr, 'Z', 64);
+    assert(realloc(ptr, 0) == NULL);
+    
+    assert(malloc_usable_size(NULL) == 0);
+    ptr = malloc(10);
+    assert(malloc_usable_size(ptr) >= 10);
+    free(ptr);
+    
+    printf("  PASSED\n");
+}
+
+static volatile int churn_stop;
+
+static void* churn(void* arg) {
+    (void)arg;
+    while (!churn_stop) {
+        void* ptrs[32];
+        for (int i = 0; i < 32; i++) {
+            ptrs[i] = malloc((size_t)(i + 1) * 48);
+        }
+        for (int i = 0; i < 32; i++) {
+            free(ptrs[i]);
+        }
+    }
+    return NULL;
+}
+
+void test_fork(void) {
+    printf("Test: fork() while other threads allocate\n");
+    
+    pthread_t threads[4];
+    for (int i = 0; i < 4; i++) {
+        assert(pthread_create(&threads[i], NULL, churn, NULL) == 0);
+    }
+    
+    for (int i = 0; i < 50; i++) {
+        pid_t pid = fork();
+        assert(pid >= 0);
+        if (pid == 0) {
+            alarm(10);  /* A lock inherited from another thread would hang here */
+            void* ptr = malloc(1000);
+            free(malloc(200 * 1024));
+            free(ptr);
+            _exit(ptr ? 0 : 1);
+        }
+        int status;
+        assert(waitpid(pid, &status, 0) == pid);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    
+    churn_stop = 1;
+    for (int i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    
+    printf("  PASSED\n");
+}
+
+int main(void) {
+    printf("LD_PRELOAD Shim Test Suite\n");
+    printf("==========================\n\n");
+    
+    test_shim_loaded();
+    test_huge_sizes();
+    test_memalign_errno();
+    test_posix_memalign();
+    test_zero_sizes();
+    test_fork();
+    
+    printf("\nAll preload tests passed!\n");
+    return 0;
+}